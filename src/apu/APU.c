@@ -10,6 +10,7 @@
 #include "../headers/apu/frame_counter.h"    // header C che abbiamo fatto prima
 #include "../headers/apu/spsc.h"             // SPSC generico (elem_size = sizeof(float))
 #include "../headers/cartridge.h"
+#include "../headers/io.h"
 
 typedef struct CPU* cpu;
 
@@ -133,6 +134,19 @@ void apu_step(apu a)
     a->divideByTwo = !a->divideByTwo;
 }
 
+int apu_steps_until_frame_irq(apu a)
+{
+    int clocks = frame_counter_clocks_until_irq(a->frame_counter);
+    if (clocks < 0) return -1;
+    /* il frame counter avanza solo negli step con divideByTwo attivo */
+    return 2 * clocks - a->divideByTwo;
+}
+
+int apu_steps_until_dmc_fetch(apu a)
+{
+    return dmc_steps_until_fetch(a->dmc);
+}
+
 /* -------------------- Scrittura registri -------------------- */
 void write_register(apu a, uint16_t addr, uint8_t value)
 {
@@ -282,3 +296,16 @@ uint8_t read_status(apu a)
     v |= (dmc_irq ? 1u : 0u)                                    << 7;
     return v;
 }
+
+/* -------------------- Registri sul bus della CPU -------------------- */
+static uint8_t apu_read_status(void* owner, uint16_t addr) { return read_status((apu)owner); }
+static void apu_write_register(void* owner, uint16_t addr, uint8_t value) { write_register((apu)owner, addr, value); }
+
+void apu_map_registers(apu a, struct CPUBus* b)
+{
+    for (uint16_t addr = APU_SQ1_VOL; addr <= APU_DMC_LEN; ++addr)
+        set_register_writer(b, addr, apu_write_register, a);
+    set_register_writer(b, APU_CONTROL, apu_write_register, a);
+    set_register_writer(b, APU_FRAME_CONTROL, apu_write_register, a);
+    set_register_reader(b, APU_CONTROL, apu_read_status, a);
+}
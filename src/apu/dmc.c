@@ -111,4 +111,10 @@ void dmc_clock(dmc d){
 
 uint8_t dmc_sample(dmc d) {
     return d -> volume;
+}
+
+int dmc_steps_until_fetch(dmc d){
+    // pop_delta only loads a new sample when the current one is used up
+    if(!d -> change_enabled || d -> remaining_bytes != 0) return -1;
+    return d -> change_rate -> counter + 1;
 }
\ No newline at end of file
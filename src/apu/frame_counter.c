@@ -81,4 +81,10 @@ void frame_counter_clock(frame_counter fc){
     }
 
     if((fc -> mode == FC_Seq4Step && fc -> counter == FC_seq4step_length) || (fc -> counter == FC_seq5step_length)) fc -> counter = 0;
+}
+
+int frame_counter_clocks_until_irq(frame_counter fc){
+    if(fc -> mode != FC_Seq4Step || fc -> interrupt_inhibit) return -1;
+    if(fc -> counter < FC_Q4) return FC_Q4 - fc -> counter;
+    return FC_seq4step_length - fc -> counter + FC_Q4;
 }
\ No newline at end of file
@@ -5,6 +5,23 @@
 #include "headers/bus.h"
 #include <string.h>
 
+// Nothing drives the data bus, it still holds the high byte of the address the CPU just fetched
+static uint8_t open_bus(void* owner, uint16_t addr){
+    (void)owner;
+    return addr >> 8;
+}
+
+static void ignore_write(void* owner, uint16_t addr, uint8_t value){
+    (void)owner; (void)addr; (void)value;
+}
+
+static void oam_dma(void* owner, uint16_t addr, uint8_t value){
+    (void)addr;
+    bus b = (bus)owner;
+    const uint8_t* page = getPagePtr(b, value);
+    if(page) b -> dma_callback(b -> ppu, (uint8_t*)page);
+}
+
 void bus_init(bus b, ppu p, apu a, cs c, void (*dma)(ppu, uint8_t*)){
     b -> RAM = (uint8_t*)calloc(0x800, sizeof(uint8_t));
     b -> dma_callback = dma;
@@ -12,102 +29,167 @@ void bus_init(bus b, ppu p, apu a, cs c, void (*dma)(ppu, uint8_t*)){
     b -> ppu = p;
     b -> apu = a;
     b -> controller_set = c;
+    b -> sync_callback = NULL;
+    b -> sync_owner = NULL;
+    b -> code_write_callback = NULL;
+    b -> code_write_owner = NULL;
+    memset(b -> code_marks, 0, sizeof(b -> code_marks));
+    b -> watch = NULL;
+    b -> watches = 0;
+    b -> watch_callback = NULL;
+    b -> watch_owner = NULL;
+    memset(b -> watched_read_page, 0, sizeof(b -> watched_read_page));
+    memset(b -> watched_write_page, 0, sizeof(b -> watched_write_page));
+
+    memset(b -> read_page, 0, sizeof(b -> read_page));
+    memset(b -> write_page, 0, sizeof(b -> write_page));
+    memset(b -> mark_page, 0, sizeof(b -> mark_page));
+    memset(b -> page_handler, PAGE_OPEN_BUS, sizeof(b -> page_handler));
+
+    // 2 KiB of RAM mirrored up to 0x1FFF
+    for(int page = 0x00; page < 0x20; ++page){
+        b -> read_page[page] = b -> write_page[page] = &b -> RAM[(page << 8) & 0x7FF];
+        b -> mark_page[page] = &b -> code_marks[(page << 8) & 0x7FF];
+    }
+    for(int page = 0x20; page <= 0x40; ++page) b -> page_handler[page] = PAGE_REGISTERS;
+    for(int page = 0x80; page < 0x100; ++page) b -> page_handler[page] = PAGE_MAPPER;
+
+    for(int i = 0; i < IO_HANDLERS; ++i){
+        b -> read_handler[i] = open_bus;
+        b -> write_handler[i] = ignore_write;
+        b -> read_owner[i] = b -> write_owner[i] = b;
+    }
+    set_register_writer(b, OAM_DMA, oam_dma, b);
 }
 
-uint16_t normalise_mirror(uint16_t addr){
-    if(addr >= PPU_CTRL && addr < APU_REGISTER_START) return addr & 0x2007;
-    return addr;
-}
-
-uint8_t bus_read(bus b, uint16_t addr){
-    if(addr < 0x2000) return b -> RAM[addr & 0x7FF];
-    else if(addr < 0x4020){
-        addr = normalise_mirror(addr);
-
-        switch (addr) {
-            case PPU_STATUS:
-                return getStatus(b -> ppu);
-            case PPU_DATA:
-                return getData(b -> ppu);
-            case JOY1:
-                return read_pad_1_as_bitmask(b -> controller_set);
-            case JOY2_AND_FRAME_CONTROL:
-                return read_pad_2_as_bitmask(b -> controller_set);
-            case OAM_DATA:
-                return getOAMData(b -> ppu);
-            case APU_CONTROL_AND_STATUS:
-                return read_status(b -> apu);
-                return 0x00;
-            default:
-                perror("Read access attempt at 0x%04X", addr);
-                return 0;
-        }
-    }else if(addr < 0x6000){
-        return 0x00;
-    }else if(addr < 0x8000){
-        if(hasExtendedRAM(b -> mapper)){
-            return b -> extRAM[addr - 0x6000];
-        }
+void set_sync_callback(bus b, void (*sync)(void*), void* owner){
+    b -> sync_callback = sync;
+    b -> sync_owner = owner;
+}
+
+void set_code_write_callback(bus b, void (*written)(void*, uint16_t), void* owner){
+    b -> code_write_callback = written;
+    b -> code_write_owner = owner;
+}
+
+void set_register_reader(bus b, uint16_t addr, io_read_handler read, void* owner){
+    b -> read_handler[IO_INDEX(addr)] = read;
+    b -> read_owner[IO_INDEX(addr)] = owner;
+}
+
+void set_register_writer(bus b, uint16_t addr, io_write_handler write, void* owner){
+    b -> write_handler[IO_INDEX(addr)] = write;
+    b -> write_owner[IO_INDEX(addr)] = owner;
+}
 
-        return 0x00;
-    } else {
-        return b -> mapper -> cpu_read(b -> mapper, addr);
+void set_watch_callback(bus b, void (*hit)(void*, uint16_t, uint8_t, uint8_t), void* owner){
+    b -> watch_callback = hit;
+    b -> watch_owner = owner;
+}
+
+// Moves the pointers of a page out of the page table while it holds watches, and back after
+static void redirect_page(bus b, int page){
+    uint8_t kinds = 0;
+    if(b -> watch)
+        for(int i = 0; i < 0x100; ++i) kinds |= b -> watch[page << 8 | i];
+
+    if((kinds & WATCH_READ) && b -> read_page[page]){
+        b -> watched_read_page[page] = b -> read_page[page];
+        b -> read_page[page] = NULL;
+    }else if(!(kinds & WATCH_READ) && b -> watched_read_page[page]){
+        b -> read_page[page] = b -> watched_read_page[page];
+        b -> watched_read_page[page] = NULL;
+    }
+
+    if((kinds & WATCH_WRITE) && b -> write_page[page]){
+        b -> watched_write_page[page] = b -> write_page[page];
+        b -> write_page[page] = NULL;
+    }else if(!(kinds & WATCH_WRITE) && b -> watched_write_page[page]){
+        b -> write_page[page] = b -> watched_write_page[page];
+        b -> watched_write_page[page] = NULL;
     }
 }
 
-void bus_write(bus b, uint16_t addr, uint8_t value){
-    if(addr < 0x2000) b -> RAM[addr & 0x7FF] = value;
-    else if(addr < 0x4020){
-        addr = normalise_mirror(addr);
-
-        switch (addr) {
-            case PPU_CTRL:
-                control(b -> ppu, value);
-                break;
-            case PPU_MASK:
-                setMask(b -> ppu, value);
-                break;
-            case OAM_ADDR:
-                setOAMAddress(b -> ppu, value);
-                break;
-            case OAM_DATA:
-                setOAMData(b -> ppu, value);
-                break;
-            case PPU_ADDR:
-                setDataAddress(b -> ppu, value);
-                break;
-            case PPU_SCROL:
-                setScroll(b -> ppu, value);
-                break;
-            case PPU_DATA:
-                setData(b -> ppu, value);
-                break;
-            case OAM_DMA:
-                b -> dma_callback(b -> ppu, &value);
-            case JOY1:
-                // m_controller1.strobe(value);
-                // m_controller2.strobe(value);
-                // break;
-            case JOY2_AND_FRAME_CONTROL:
-            case APU_CONTROL_AND_STATUS:
-                write_register(b -> apu, addr, value);
-                break;
-            default:
-                if(addr >= APU_REGISTER_START && addr <= APU_REGISTER_END) write_register(b -> apu, addr, value);
-                else perror("Write access attempt at 0x%04X", addr);
-                break;
-        }
-    }else if(addr < 0x6000){
+// Mappers write their banks straight into the page table, so watched PRG-ROM pages are redone
+static void redirect_prg_pages(bus b){
+    for(int page = 0x80; page < 0x100; ++page){
+        if(b -> read_page[page]) b -> watched_read_page[page] = NULL;
+        redirect_page(b, page);
+    }
+}
 
-    }else if(addr < 0x8000){
-        if(hasExtendedRAM(b -> mapper)){
-            b -> extRAM[addr - 0x6000] = value;
+void bus_set_watch(bus b, uint16_t addr, uint8_t kinds){
+    if(!b -> watch){
+        if(!kinds) return;
+        b -> watch = (uint8_t*)calloc(0x10000, sizeof(uint8_t));
+        if(!b -> watch){
+            perror("Error allocating watchpoints");
+            exit(EXIT_FAILURE);
         }
-    } else {
+    }
+
+    b -> watches += (kinds != 0) - (b -> watch[addr] != 0);
+    b -> watch[addr] = kinds;
+    redirect_page(b, addr >> 8);
+
+    // Nothing left to check, every access is back on the page table
+    if(!b -> watches){
+        free(b -> watch);
+        b -> watch = NULL;
+    }
+}
+
+// Pages without a direct pointer, see bus_read
+static uint8_t read_unwatched(bus b, uint16_t addr){
+    if(b -> page_handler[addr >> 8] == PAGE_MAPPER) return b -> mapper -> cpu_read(b -> mapper, addr);
+    else if(b -> page_handler[addr >> 8] == PAGE_REGISTERS && addr < 0x4020){
+        if(b -> sync_callback) b -> sync_callback(b -> sync_owner);
+        return b -> read_handler[IO_INDEX(addr)](b -> read_owner[IO_INDEX(addr)], addr);
+    }
+
+    return open_bus(b, addr);
+}
+
+static void write_unwatched(bus b, uint16_t addr, uint8_t value){
+    if(b -> page_handler[addr >> 8] == PAGE_REGISTERS && addr < 0x4020){
+        if(b -> sync_callback) b -> sync_callback(b -> sync_owner);
+        b -> write_handler[IO_INDEX(addr)](b -> write_owner[IO_INDEX(addr)], addr, value);
+    }else if(b -> page_handler[addr >> 8] == PAGE_MAPPER){
+        // Bank switches change what the PPU fetches, so it must be up to date first
+        if(b -> sync_callback) b -> sync_callback(b -> sync_owner);
         b -> mapper -> cpu_write(b -> mapper, addr, value);
+        if(b -> watch) redirect_prg_pages(b);
     }
 }
 
+uint8_t bus_read_page(bus b, uint16_t addr){
+    if(!b -> watch) return read_unwatched(b, addr);
+
+    const uint8_t* page = b -> watched_read_page[addr >> 8];
+    uint8_t value = page ? page[addr & 0xFF] : read_unwatched(b, addr);
+    if((b -> watch[addr] & WATCH_READ) && b -> watch_callback)
+        b -> watch_callback(b -> watch_owner, addr, WATCH_READ, value);
+    return value;
+}
+
+void bus_write_page(bus b, uint16_t addr, uint8_t value){
+    if(!b -> watch){
+        write_unwatched(b, addr, value);
+        return;
+    }
+
+    if((b -> watch[addr] & WATCH_WRITE) && b -> watch_callback)
+        b -> watch_callback(b -> watch_owner, addr, WATCH_WRITE, value);
+
+    uint8_t* page = b -> watched_write_page[addr >> 8];
+    if(!page){
+        write_unwatched(b, addr, value);
+        return;
+    }
+    page[addr & 0xFF] = value;
+    if(b -> mark_page[addr >> 8][addr & 0xFF]) b -> code_write_callback(b -> code_write_owner, addr);
+}
+
 bool setMapper(bus b, mapper mapper){
     b -> mapper = mapper;
 
@@ -118,18 +200,31 @@ bool setMapper(bus b, mapper mapper){
 
     if(hasExtendedRAM(b -> mapper)){
         b -> extRAM = (uint8_t*)calloc(0x2000, sizeof(uint8_t));
+        for(int page = 0x60; page < 0x80; ++page){
+            b -> read_page[page] = b -> write_page[page] = &b -> extRAM[(page - 0x60) << 8];
+            b -> mark_page[page] = &b -> code_marks[0x800 + ((page - 0x60) << 8)];
+        }
+    }
+
+    // Mappers that don't map their banks are read through cpu_read
+    memset(&b -> read_page[0x80], 0, 0x80 * sizeof(b -> read_page[0]));
+    mapper -> prg_pages = &b -> read_page[0x80];
+    if(mapper -> map_prg) mapper -> map_prg(mapper);
+
+    for(int page = 0x60; page < 0x100 && b -> watch; ++page){
+        if(b -> read_page[page]) b -> watched_read_page[page] = NULL;
+        if(b -> write_page[page]) b -> watched_write_page[page] = NULL;
+        redirect_page(b, page);
     }
 
     return true;
 }
 
 const uint8_t* getPagePtr(bus b, uint8_t page){
-    uint16_t addr = page << 8;
-    if(addr < 0x2000) return &b -> RAM[addr & 0x7FF];
-    else if(addr < 0x4020) perror("Register address memory pointer access attempt");
-    else if(addr < 0x6000) perror("Expansion ROM access attempted, which is unsupported");
-    else if(addr < 0x8000) {
-        if(hasExtendedRAM(b -> mapper)) return &b -> extRAM[addr & 0x6000];
-    } else perror("Unexpected DMA request");
+    if(b -> read_page[page]) return b -> read_page[page];
+    else if(b -> watched_read_page[page]) return b -> watched_read_page[page];
+    else if(b -> page_handler[page] == PAGE_REGISTERS) perror("Register address memory pointer access attempt");
+    else if(b -> page_handler[page] == PAGE_OPEN_BUS) perror("Expansion ROM access attempted, which is unsupported");
+    else perror("Unexpected DMA request");
     return NULL;
 }
@@ -3,6 +3,7 @@
 //
 
 #include "headers/controller.h"
+#include "headers/bus.h"
 #include <raylib.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -72,6 +73,15 @@ uint8_t controller_cpu_read(cs c, uint16_t addr){
     return 0xFF; // open bus
 }
 
+static uint8_t read_pad(void* owner, uint16_t addr) { return controller_cpu_read((cs)owner, addr); }
+static void write_strobe(void* owner, uint16_t addr, uint8_t value) { controller_cpu_write((cs)owner, addr, value); }
+
+void controller_map_registers(cs c, struct CPUBus* b){
+    set_register_reader(b, JOY1, read_pad, c);
+    set_register_reader(b, JOY2_AND_FRAME_CONTROL, read_pad, c);
+    set_register_writer(b, JOY1, write_strobe, c);
+}
+
 uint8_t controller_read_serial(controller c){
     if (!c) return 1; // open bus behaviour, bit0 high
 
@@ -92,6 +102,7 @@ uint8_t controller_read_serial(controller c){
 }
 
 uint8_t read_pad_1_as_bitmask(cs c){
+    (void)c;
     uint8_t mask = 0;
 
     bool gp0 = IsGamepadAvailable(0);
@@ -114,6 +125,7 @@ uint8_t read_pad_1_as_bitmask(cs c){
 }
 
 uint8_t read_pad_2_as_bitmask(cs c){
+    (void)c;
     uint8_t mask = 0;
 
     bool gp1 = IsGamepadAvailable(1);
@@ -4,6 +4,11 @@
 
 #include "headers/cpu.h"
 #include "headers/CPUopcodes.h"
+#include "headers/debugger.h"
+
+#ifdef CPU_DYNAREC
+#include "headers/dynarec.h"
+#endif
 
 void irq_init(irq_handler irq, int bit, cpu c){
     irq -> c = c;
@@ -25,48 +30,49 @@ void pull(irq_handle irq){
 // CPU
 // Private
 
-void setZN(cpu c, uint8_t value){
-    c -> Z = !value;
-    c -> N = value & 0x80;
+// N and Z are worked out from the result when something reads them
+static void setZN(registers r, uint8_t value) { r -> nz = value; }
+
+static void set_flag(registers r, uint8_t flag, bool value){
+    r -> P = (r -> P & ~flag) | (value ? flag : 0);
 }
 
 uint16_t read_address(cpu c, uint16_t addr);
 
-void push_stack(cpu c, uint8_t value) {
-    bus_write(c -> bus, 0x100 | c -> SP, value);
-    --c -> SP;
+static void push_stack(cpu c, registers r, uint8_t value) {
+    bus_write(c -> bus, 0x100 | r -> SP, value);
+    --r -> SP;
 }
 
-uint8_t pull_stack(cpu c){
-    return bus_read(c -> bus, 0x100 | ++c -> SP);
+static uint8_t pull_stack(cpu c, registers r){
+    return bus_read(c -> bus, 0x100 | ++r -> SP);
 }
 
-void skipPageCrossCycle(cpu c, uint16_t a, uint16_t b){
+static void skipPageCrossCycle(cpu c, uint16_t a, uint16_t b){
     if ((a & 0xff00) != (b & 0xff00)) c -> skip_cycles += 1;
 }
 
-void interrupt_sequence(cpu c, enum InterruptType type){
-    if(c -> I && type != NMI && type != BRK_){
+static void interrupt_sequence(cpu c, registers r, enum InterruptType type){
+    if((r -> P & FLAG_I) && type != NMI && type != BRK_){
         return;
     }
 
-    if(type == BRK_) ++c -> PC;
+    if(type == BRK_) ++r -> PC;
 
-    push_stack(c, c -> PC >> 8);
-    push_stack(c, c -> PC);
+    push_stack(c, r, r -> PC >> 8);
+    push_stack(c, r, r -> PC);
 
-    uint8_t flags = c -> N << 7 | c -> V << 6 | 1 << 5 | (type == BRK_) << 4 | c -> D << 3 | c -> I << 2 | c -> Z << 1 | c -> C;
-    push_stack(c, flags);
+    push_stack(c, r, get_P(r) | (type == BRK_) << 4);
 
-    c -> I = true;
+    r -> P |= FLAG_I;
 
     switch (type) {
         case IRQ:
         case BRK_:
-            c -> PC = read_address(c, IRQ_VECTOR);
+            r -> PC = read_address(c, IRQ_VECTOR);
             break;
         case NMI:
-            c -> PC = read_address(c, NMI_VECTOR);
+            r -> PC = read_address(c, NMI_VECTOR);
             break;
         default:
             perror("Unknown interrupt");
@@ -76,482 +82,493 @@ void interrupt_sequence(cpu c, enum InterruptType type){
 
 }
 
-bool execute_implied(cpu c, uint8_t opcode){
-    switch (((enum operation_implied)(opcode)))
+static void idle_loop_check(cpu c, registers r, uint16_t end_pc);
+
+static void take_branch(cpu c, registers r, int8_t offset, uint16_t branch_pc){
+    ++c -> skip_cycles;
+    uint16_t newPC = (uint16_t)(r -> PC + offset);
+    skipPageCrossCycle(c, r -> PC, newPC);
+    r -> PC = newPC;
+    if (offset < 0) idle_loop_check(c, r, branch_pc);
+}
+
+static uint8_t shift_left(registers r, uint8_t value, bool rotate){
+    bool prev_C = r -> P & FLAG_C;
+    set_flag(r, FLAG_C, value & 0x80);
+    // If Rotating, set the bit-0 to the the previous carry
+    value       = value << 1 | (prev_C && rotate);
+    setZN(r, value);
+    return value;
+}
+
+static uint8_t shift_right(registers r, uint8_t value, bool rotate){
+    bool prev_C = r -> P & FLAG_C;
+    set_flag(r, FLAG_C, value & 1);
+    // If Rotating, set the bit-7 to the previous carry
+    value       = value >> 1 | (prev_C && rotate) << 7;
+    setZN(r, value);
+    return value;
+}
+
+// The handlers are in cpu_core.c, included further down
+#define OPCODE_DECLARATION(opcode, operation, mode, cycles, page_penalty, access) \
+    static void opcode_##opcode(cpu c, registers r, uint16_t operand);
+CPU_OPCODES(OPCODE_DECLARATION)
+#undef OPCODE_DECLARATION
+
+static void execute_fused(cpu c, registers r, const struct DecodedInstruction* d);
+
+enum{
+#define MODE_LENGTH(mode, length, format) LENGTH_##mode = length,
+    CPU_ADDRESSING_MODES(MODE_LENGTH)
+#undef MODE_LENGTH
+};
+
+// Dispatch table, indexed by opcode. Unused opcodes are left with 0 cycles.
+static const struct Opcode dispatch_table[0x100] = {
+#define OPCODE_ENTRY(opcode, operation, mode, cycles, page_penalty, access) \
+    [opcode] = { opcode_##opcode, cycles, LENGTH_##mode, OP_##operation, MODE_##mode, ACCESS_##access, page_penalty },
+    CPU_OPCODES(OPCODE_ENTRY)
+#undef OPCODE_ENTRY
+};
+
+// Decode cache slot of an address: RAM mirrors share a slot, then PRG-RAM and PRG-ROM.
+// The register and expansion space is never cached.
+static inline int decode_slot(uint16_t addr){
+    if (addr < 0x2000) return addr & 0x7ff;
+    if (addr < 0x6000) return -1;
+    return addr - 0x6000 + 0x800;
+}
+
+// PRG-ROM entries are only valid for the bank mapping they were decoded with
+static inline uint32_t decode_tag(cpu c, uint16_t addr){
+    return addr >= 0x8000 ? c -> bus -> mapper -> prg_generation : 1;
+}
+
+// Looks for a superinstruction starting with the PRG-ROM instruction d at pc
+static void detect_fusion(cpu c, uint16_t pc, struct DecodedInstruction* d){
+    uint16_t next = pc + d -> length;
+    if (next < 0x8000 || next > 0xfffc) return;
+
+    uint8_t tail[4];
+    for (int i = 0; i < 4; ++i) tail[i] = bus_read(c -> bus, next + i);
+
+    enum Fusion fusion = FUSION_NONE;
+    switch (d -> opcode)
     {
-        case NOP:
-            break;
-        case BRK:
-            interrupt_sequence(c, BRK_);
-            break;
-        case JSR:
-            push_stack(c, (uint8_t)((c -> PC + 1) >> 8));
-            push_stack(c, (uint8_t)(c -> PC + 1));
-            c -> PC = read_address(c, c -> PC);
+        case OPCODE_DEX_IMPLIED:
+            if (tail[0] == OPCODE_BNE_RELATIVE) fusion = FUSION_DEX_BNE;
             break;
-        case RTS:
-            c -> PC  = pull_stack(c);
-            c -> PC |= pull_stack(c) << 8;
-            ++c -> PC;
-            break;
-        case RTI:
-        {
-            uint8_t flags = pull_stack(c);
-            c -> N        = flags & 0x80;
-            c -> V        = flags & 0x40;
-            c -> D        = flags & 0x8;
-            c -> I        = flags & 0x4;
-            c -> Z        = flags & 0x2;
-            c -> C        = flags & 0x1;
-        }
-            c -> PC  = pull_stack(c);
-            c -> PC |= pull_stack(c) << 8;
+        case OPCODE_INY_IMPLIED:
+            if (tail[0] == OPCODE_CPY_IMMEDIATE && tail[2] == OPCODE_BNE_RELATIVE) fusion = FUSION_INY_CPY_IMM_BNE;
+            if (tail[0] == OPCODE_CPY_ZERO_PAGE && tail[2] == OPCODE_BNE_RELATIVE) fusion = FUSION_INY_CPY_ZP_BNE;
             break;
-        case JMP:
-            c -> PC = read_address(c, c -> PC);
-            break;
-        case JMPI:
-        {
-            uint16_t location = read_address(c, c -> PC);
-            uint16_t Page     = location & 0xff00;
-            c -> PC             = bus_read(c -> bus,location) | bus_read(c -> bus,Page | ((location + 1) & 0xff)) << 8;
-        }
-            break;
-        case PHP:
-        {
-            uint8_t flags = c -> N << 7 | c -> V << 6 | 1 << 5 | // supposed to always be 1
-                         1 << 4 |                       // PHP pushes with the B flag as 1, no matter what
-                         c -> D << 3 | c -> I << 2 | c -> Z << 1 | c -> C;
-            push_stack(c, flags);
-        }
-            break;
-        case PLP:
-        {
-            uint8_t flags = pull_stack(c);
-            c -> N        = flags & 0x80;
-            c -> V        = flags & 0x40;
-            c -> D        = flags & 0x8;
-            c -> I        = flags & 0x4;
-            c -> Z        = flags & 0x2;
-            c -> C        = flags & 0x1;
-        }
-            break;
-        case PHA:
-            push_stack(c, c -> A);
-            break;
-        case PLA:
-            c -> A = pull_stack(c);
-            setZN(c, c -> A);
-            break;
-        case DEY:
-            --c -> Y;
-            setZN(c, c -> Y);
-            break;
-        case DEX:
-            --c -> X;
-            setZN(c, c -> X);
-            break;
-        case TAY:
-            c -> Y = c -> A;
-            setZN(c, c -> Y);
-            break;
-        case INY:
-            ++c -> Y;
-            setZN(c, c -> Y);
-            break;
-        case INX:
-            ++c -> X;
-            setZN(c, c -> X);
-            break;
-        case CLC:
-            c -> C = false;
-            break;
-        case SEC:
-            c -> C = true;
-            break;
-        case CLI:
-            c -> I = false;
-            break;
-        case SEI:
-            c -> I = true;
-            break;
-        case CLD:
-            c -> D = false;
-            break;
-        case SED:
-            c -> D = true;
-            break;
-        case TYA:
-            c -> A = c -> Y;
-            setZN(c, c -> A);
-            break;
-        case CLV:
-            c -> V = false;
-            break;
-        case TXA:
-            c -> A = c -> X;
-            setZN(c, c -> A);
-            break;
-        case TXS:
-            c -> SP = c -> X;
-            break;
-        case TAX:
-            c -> X = c -> A;
-            setZN(c, c -> X);
-            break;
-        case TSX:
-            c -> X = c -> SP;
-            setZN(c, c -> X);
+        case OPCODE_LDA_IMMEDIATE:
+        case OPCODE_LDA_ZERO_PAGE:
+        case OPCODE_LDA_ABSOLUTE:
+            if (d -> opcode == OPCODE_LDA_ABSOLUTE && d -> operand == PPU_STATUS && tail[0] == OPCODE_BPL_RELATIVE)
+                fusion = FUSION_LDA_PPU_STATUS_BPL;
+            else if (tail[0] == OPCODE_STA_ZERO_PAGE)
+                fusion = FUSION_LDA_STA_ZP;
             break;
         default:
-            return false;
-    };
-    return true;
+            break;
+    }
+
+    // Operands of the instructions after the first one, low byte first
+    d -> fusion        = fusion;
+    d -> fused_operand = fusion == FUSION_INY_CPY_IMM_BNE || fusion == FUSION_INY_CPY_ZP_BNE ? tail[1] | tail[3] << 8
+                                                                                             : tail[1];
 }
-bool execute_branch(cpu c, uint8_t opcode){
-    if ((opcode & BRANCH_INSTR_MASK) == BRANCH_INSTR_MASK_RESULT)
+
+static void decode(cpu c, uint16_t pc, struct DecodedInstruction* d){
+    d -> opcode  = bus_read(c -> bus, pc);
+    // Unused opcodes are skipped as one byte
+    d -> length  = dispatch_table[d -> opcode].cycles ? dispatch_table[d -> opcode].length : 1;
+    d -> fusion  = FUSION_NONE;
+    d -> operand = 0;
+    if (d -> length > 1) d -> operand  = bus_read(c -> bus, pc + 1);
+    if (d -> length > 2) d -> operand |= bus_read(c -> bus, pc + 2) << 8;
+
+    // Instructions running across a mirror or region boundary are decoded every time
+    uint16_t last = pc + d -> length - 1;
+    int      slot = decode_slot(pc);
+    if (slot < 0 || decode_slot(last) != slot + d -> length - 1 || (pc < 0x8000) != (last < 0x8000))
     {
-        bool branch = opcode & BRANCH_COND_MASK;
+        d -> tag = 0;
+        return;
+    }
+    d -> tag = decode_tag(c, pc);
 
-        switch (opcode >> BRANCH_ON_FLAG_SHIFT)
-        {
-            case Negative:
-                branch = !(branch ^ c -> N);
-                break;
-            case Overflow:
-                branch = !(branch ^ c -> V);
-                break;
-            case Carry:
-                branch = !(branch ^ c -> C);
-                break;
-            case Zero:
-                branch = !(branch ^ c -> Z);
-                break;
-            default:
-                return false;
-        }
+    // Code in RAM or PRG-RAM is dropped when the program writes over it, see code_written
+    if (pc < 0x8000)
+        for (int i = 0; i < d -> length; ++i) c -> bus -> code_marks[slot + i] = 1;
+    else
+        detect_fusion(c, pc, d);
+}
 
-        if (branch)
-        {
-            int8_t offset = bus_read(c -> bus, c -> PC++);
-            ++c -> skip_cycles;
-            uint16_t newPC = (uint16_t)(c -> PC + offset);
-            skipPageCrossCycle(c, c -> PC, newPC);
-            c -> PC = newPC;
-        }
-        else
-            ++c -> PC;
-        return true;
-    }
-    return false;
+// Returns the decoded instruction at pc, scratch is used for addresses that are never cached
+static inline const struct DecodedInstruction* lookup(cpu c, uint16_t pc, struct DecodedInstruction* scratch){
+    int                        slot = decode_slot(pc);
+    struct DecodedInstruction* d    = slot < 0 ? scratch : &c -> decode_cache[slot];
+
+    if (slot < 0 || d -> tag != decode_tag(c, pc)) decode(c, pc, d);
+    return d;
 }
 
-bool execute_type0(cpu c, uint8_t opcode){
-    if ((opcode & INSTRUCTION_MODE_MASK) == 0x0)
+// Fetches the instruction at PC from the decode cache and moves PC past it
+static inline const struct DecodedInstruction* fetch(cpu c, registers r, struct DecodedInstruction* scratch){
+    const struct DecodedInstruction* d = lookup(c, r -> PC, scratch);
+    r -> PC += d -> length;
+    return d;
+}
+
+// Called by the bus when a write hits RAM/PRG-RAM bytes that hold decoded code
+static void code_written(void* owner, uint16_t addr){
+    cpu c = (cpu)owner;
+    // Any instruction covering addr starts at most two bytes before it
+    for (uint16_t i = 0; i < 3; ++i)
     {
-        uint16_t location = 0;
-        switch ((enum addr_mode_2)((opcode & ADDR_MODE_MASK) >> ADDR_MODE_SHIFT))
-        {
-            case Immediate_:
-                location = c -> PC++;
-                break;
-            case ZeroPage_:
-                location = bus_read(c -> bus,c -> PC++);
-                break;
-            case Absolute_:
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                break;
-            case Indexed:
-                // Address wraps around in the zero page
-                location = (bus_read(c -> bus,c -> PC++) + c -> X) & 0xff;
-                break;
-            case AbsoluteIndexed:
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                skipPageCrossCycle(c, location, location + c -> X);
-                location += c -> X;
-                break;
-            default:
-                return false;
-        }
-        uint16_t operand = 0;
-        switch ((enum operation_0)((opcode & OPERATION_MASK) >> OPERATION_SHIFT))
-        {
-            case BIT:
-                operand = bus_read(c -> bus,location);
-                c -> Z     = !(c -> A & operand);
-                c -> V     = operand & 0x40;
-                c -> N     = operand & 0x80;
-                break;
-            case STY:
-                bus_write(c -> bus,location, c -> Y);
-                break;
-            case LDY:
-                c -> Y = bus_read(c -> bus,location);
-                setZN(c, c -> Y);
-                break;
-            case CPY:
-            {
-                uint16_t diff = c -> Y - bus_read(c -> bus,location);
-                c -> C                = !(diff & 0x100);
-                setZN(c, diff);
-            }
-                break;
-            case CPX:
-            {
-                uint16_t diff = c -> X - bus_read(c -> bus,location);
-                c -> C                = !(diff & 0x100);
-                setZN(c, diff);
-            }
-                break;
-            default:
-                return false;
-        }
+        int slot = decode_slot(addr - i);
+        if (slot >= 0) c -> decode_cache[slot].tag = 0;
+    }
+    c -> bus -> code_marks[decode_slot(addr)] = 0;
+}
 
+// One log line per instruction, to compare the tiers against each other (make CPU_TRACE=1).
+// Left out of every other build, it costs a bus read, the N/Z flags and a file write each time
+#ifdef CPU_TRACE
+static void trace_instruction(cpu c, registers r){
+    printf(
+            "%04X  %02X  A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%3d",
+            r -> PC, bus_read(c -> bus, r -> PC),
+            r -> A, r -> X, r -> Y, get_P(r), r -> SP,
+            (int)(((c -> cycles - 1) * 3) % 341)
+    );
+}
+#define TRACE_INSTRUCTION(c, r) trace_instruction(c, r)
+#else
+#define TRACE_INSTRUCTION(c, r) ((void)0)
+#endif
+
+// Services a pending interrupt, returns false when there is none
+static bool service_interrupt(cpu c, registers r){
+    if(c -> pending_NMI){
+        interrupt_sequence(c, r, NMI);
+        c -> pending_NMI = false;
+        return true;
+    }else if(!(r -> P & FLAG_I) && c -> irq_pulldowns){
+        interrupt_sequence(c, r, IRQ);
         return true;
     }
     return false;
 }
 
-bool execute_type1(cpu c, uint8_t opcode){
-    if ((opcode & INSTRUCTION_MODE_MASK) == 0x1)
+// cpu_run stops one cycle before the next event so the caller can catch up before it is due
+static int64_t stop_cycle(cpu c, int64_t end){
+    return c -> next_event - 1 < end ? c -> next_event - 1 : end;
+}
+
+// A superinstruction goes on with its next part only where cpu_run would start it right away:
+// on a boundary before the stop cycle, with no interrupt pending
+static inline bool fusion_continues(cpu c, registers r){
+    return c -> cycles + c -> skip_cycles <= stop_cycle(c, c -> run_end) &&
+           !c -> pending_NMI && ((r -> P & FLAG_I) || !c -> irq_pulldowns);
+}
+
+// Runs whatever starts on an instruction boundary: a pending interrupt or the next instruction
+static void execute(cpu c, registers r){
+    if (service_interrupt(c, r)) return;
+
+    TRACE_INSTRUCTION(c, r);
+
+    struct DecodedInstruction        scratch;
+    const struct DecodedInstruction* d = fetch(c, r, &scratch);
+
+    // Superinstructions only run inside cpu_run, cpu_step callers step the other chips in between.
+    // The reference tier runs every instruction on its own.
+    if (d -> fusion && c -> run_end > c -> cycles && c -> core -> fast_paths)
     {
-        uint16_t location = 0;
-        int op = (enum operation_1)((opcode & OPERATION_MASK) >> OPERATION_SHIFT);
-        switch ((enum addr_mode_1)((opcode & ADDR_MODE_MASK) >> ADDR_MODE_SHIFT))
+        execute_fused(c, r, d);
+        return;
+    }
+
+    const struct Opcode* op = &dispatch_table[d -> opcode];
+
+    if (op -> cycles) {
+        op -> handler(c, r, d -> operand);
+    } else {
+        perror("Unrecognized opcode: 0x%04X", d -> opcode);
+    }
+}
+
+static void update_next_event(cpu c){
+    c -> next_event = CPU_NO_EVENT;
+    for (int i = 0; i < c -> events_size; ++i)
+        if (c -> events[i] < c -> next_event) c -> next_event = c -> events[i];
+}
+
+// Events are one-shot: the ones reached by the slice are disarmed. An idle loop iteration
+// still running then read its values before the event, so the loop is checked from scratch
+static void expire_events(cpu c){
+    for (int i = 0; i < c -> events_size; ++i)
+        if (c -> events[i] <= c -> cycles + 1)
         {
-            case IndexedIndirectX:
-            {
-                uint8_t zero_addr = c -> X + bus_read(c -> bus,c -> PC++);
-                // Addresses wrap in zero page mode, thus pass through a mask
-                location       = bus_read(c -> bus,zero_addr & 0xff) | bus_read(c -> bus,(zero_addr + 1) & 0xff) << 8;
-            }
-                break;
-            case ZeroPage:
-                location = bus_read(c -> bus,c -> PC++);
-                break;
-            case Immediate:
-                location = c -> PC++;
-                break;
-            case Absolute:
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                break;
-            case IndirectY:
-            {
-                uint8_t zero_addr = bus_read(c -> bus,c -> PC++);
-                location       = bus_read(c -> bus,zero_addr & 0xff) | bus_read(c -> bus,(zero_addr + 1) & 0xff) << 8;
-                if (op != STA)
-                    skipPageCrossCycle(c, location, location + c -> Y);
-                location += c -> Y;
-            }
-                break;
-            case IndexedX:
-                // Address wraps around in the zero page
-                location = (bus_read(c -> bus,c -> PC++) + c -> X) & 0xff;
-                break;
-            case AbsoluteY:
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                if (op != STA)
-                    skipPageCrossCycle(c, location, location + c -> Y);
-                location += c -> Y;
-                break;
-            case AbsoluteX:
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                if (op != STA)
-                    skipPageCrossCycle(c, location, location + c -> X);
-                location += c -> X;
-                break;
-            default:
-                return false;
+            c -> events[i]   = CPU_NO_EVENT;
+            c -> idle_branch = -1;
         }
+    update_next_event(c);
+}
+
+// Idle loops: a short loop that only reads RAM and branches back gives the same result on
+// every iteration until an interrupt arrives, and LDA/BIT $2002 + BPL/BMI until vblank.
+// Both only happen on scheduled events, so cpu_run skips whole iterations up to the next one.
+
+static bool idle_loop_instruction(const struct Opcode* op){
+    if (op -> operation == OP_NOP) return true;
+    if (op -> addressing != MODE_IMMEDIATE && op -> addressing != MODE_ZERO_PAGE && op -> addressing != MODE_ABSOLUTE)
+        return false;
+    // Loads, compares and the idempotent logic operations
+    return op -> operation == OP_LDA || op -> operation == OP_LDX || op -> operation == OP_LDY ||
+           op -> operation == OP_BIT || op -> operation == OP_CMP || op -> operation == OP_CPX ||
+           op -> operation == OP_CPY || op -> operation == OP_AND || op -> operation == OP_ORA;
+}
+
+// Cycles of one iteration of the loop from target to the branch or jump at end_pc, 0 if it can't be skipped
+static int idle_loop_period(cpu c, uint16_t target, uint16_t end_pc){
+    if (target > end_pc || end_pc - target > IDLE_LOOP_MAX_LENGTH || decode_slot(target) < 0) return 0;
 
-        switch (op)
+    struct DecodedInstruction        scratch;
+    const struct DecodedInstruction* d;
+    const struct Opcode*             op;
+    const struct Opcode*             body      = NULL;
+    int                              period    = 0;
+    int                              count     = 0;
+    bool                             ppu_status = false;
+
+    for (uint16_t pc = target; pc != end_pc; pc += d -> length, ++count)
+    {
+        if (pc > end_pc) return 0;
+        d  = lookup(c, pc, &scratch);
+        op = &dispatch_table[d -> opcode];
+        if (!idle_loop_instruction(op)) return 0;
+
+        if (op -> addressing != MODE_IMMEDIATE && op -> addressing != MODE_IMPLIED)
         {
-            case ORA:
-                c -> A |= bus_read(c -> bus,location);
-                setZN(c, c -> A);
-                break;
-            case AND:
-                c -> A &= bus_read(c -> bus,location);
-                setZN(c, c -> A);
-                break;
-            case EOR:
-                c -> A ^= bus_read(c -> bus,location);
-                setZN(c, c -> A);
-                break;
-            case ADC:
-            {
-                uint8_t          operand = bus_read(c -> bus,location);
-                uint16_t sum     = c -> A + operand + c -> C;
-                // Carry forward or UNSIGNED overflow
-                c -> C                   = sum & 0x100;
-                // SIGNED overflow, would only happen if the sign of sum is
-                // different from BOTH the operands
-                c -> V                   = (c -> A ^ sum) & (operand ^ sum) & 0x80;
-                c -> A                   = sum;
-                setZN(c, c -> A);
-            }
-                break;
-            case STA:
-                bus_write(c -> bus,location, c -> A);
-                break;
-            case LDA:
-                c -> A = bus_read(c -> bus,location);
-                setZN(c, c -> A);
-                break;
-            case SBC:
-            {
-                uint16_t subtrahend = bus_read(c -> bus,location), diff = c -> A - subtrahend - !c -> C;
-                c -> C = !(diff & 0x100);
-                c -> V = (c -> A ^ diff) & (~subtrahend ^ diff) & 0x80;
-                c -> A = diff;
-                setZN(c, diff);
-            }
-                break;
-            case CMP:
-            {
-                uint16_t diff = c -> A - bus_read(c -> bus,location);
-                c -> C                = !(diff & 0x100);
-                setZN(c, diff);
-            }
-                break;
-            default:
-                return false;
+            if (d -> operand >= 0x2000 && d -> operand < 0x4000 && (d -> operand & 0x7) == 2) ppu_status = true;
+            else if (d -> operand >= 0x2000 && (d -> operand < 0x6000 || d -> operand >= 0x8000)) return 0;
         }
-        return true;
+        body    = op;
+        period += op -> cycles;
     }
-    return false;
+
+    d  = lookup(c, end_pc, &scratch);
+    op = &dispatch_table[d -> opcode];
+    if (op -> operation == OP_JMP && op -> addressing == MODE_ABSOLUTE)
+        period += op -> cycles;
+    else if (op -> addressing == MODE_RELATIVE)
+        period += op -> cycles + 1 + ((target & 0xff00) != ((end_pc + 2) & 0xff00));
+    else
+        return 0;
+
+    // Other status bits, like sprite 0 hit, change without an event
+    if (ppu_status && !(count == 1 && (body -> operation == OP_LDA || body -> operation == OP_BIT) &&
+                        (op -> operation == OP_BPL || op -> operation == OP_BMI)))
+        return 0;
+
+    return period;
 }
 
+// Called after a backward branch or jump to r -> PC was taken from end_pc
+static void idle_loop_check(cpu c, registers r, uint16_t end_pc){
+    // Only inside cpu_run on a tier with fast paths, and never past a pending interrupt
+    if (!c -> core -> fast_paths || c -> run_end <= c -> cycles) return;
+    if (c -> pending_NMI || (!(r -> P & FLAG_I) && c -> irq_pulldowns)) return;
+
+    int period = idle_loop_period(c, r -> PC, end_pc);
+    if (!period) return;
+
+    // The branch must have been taken one period ago too, so a whole iteration just ran
+    // and the flags don't come from before an interrupt or from a jump into the loop
+    int64_t now    = c -> cycles + c -> skip_cycles;
+    bool    repeat = c -> idle_branch == end_pc && now - c -> idle_mark == period;
+    c -> idle_branch = end_pc;
+    c -> idle_mark   = now;
+    if (!repeat) return;
+
+    // The last iteration before the stop cycle is left to the interpreter, so registers
+    // and flags come from an up to date read. The branch itself takes at most 3 more cycles.
+    int64_t next       = now + 3;
+    int64_t iterations = (stop_cycle(c, c -> run_end) - next) / period - 1;
+    if (iterations <= 0) return;
+
+    c -> skip_cycles         += (int)(iterations * period);
+    c -> idle_skipped_cycles += iterations * period;
+}
+
+// Public
+
+uint16_t read_address(cpu c, uint16_t addr){
+    return bus_read(c -> bus, addr) | bus_read(c -> bus, addr + 1) << 8;
+}
 
-bool execute_type2(cpu c, uint8_t opcode){
-    if ((opcode & INSTRUCTION_MODE_MASK) == 2)
+void cpu_step(cpu c){
+    ++c -> cycles;
+    if(c -> skip_cycles-- > 1) return;
+    c -> skip_cycles = 0;
+
+    execute(c, &c -> regs);
+}
+
+// Core tiers. They all run on c -> regs and the same handlers, and differ in dispatch only.
+
+// Handlers and fast tier reading memory through the bus page table, used by every mapper
+#define CORE(name)          name
+#define CORE_READ(c, addr)  bus_read((c) -> bus, addr)
+#include "cpu_core.c"
+
+#if defined(CPU_MAPPER_CORES) && defined(__GNUC__)
+// NROM never switches banks, so the fast tier built for it reads RAM and PRG-ROM straight
+// from their arrays and leaves only registers and PRG-RAM to the bus
+static inline uint8_t nrom_read(cpu c, uint16_t addr){
+    if (addr >= 0x8000) return c -> flat_prg[addr & c -> flat_prg_mask];
+    if (addr < 0x2000) return c -> bus -> RAM[addr & 0x7ff];
+    return bus_read(c -> bus, addr);
+}
+
+#define CORE(name)          name##_nrom
+#define CORE_READ(c, addr)  nrom_read(c, addr)
+#include "cpu_core.c"
+
+// Fast tier builds for a single mapper, cpu_use_mapper swaps them in for "fast"
+static const struct CPUMapperCore{
+    mapper_type           type;
+    struct CPUCore        core;
+} mapper_cores[] = {
+    { NROM, { "fast", run_threaded_nrom, true } },
+};
+
+#define MAPPER_CORES_SIZE ((int)(sizeof(mapper_cores) / sizeof(mapper_cores[0])))
+#endif
+
+// Reference tier, a plain dispatch loop. The recompiler runs its blocks from the same loop,
+// and the debug tier checks breakpoints in it.
+static inline __attribute__((always_inline)) int64_t run_loop(cpu c, int64_t cycle_budget, bool recompile, bool debug){
+#ifndef CPU_DYNAREC
+    (void)recompile;
+#endif
+    struct Registers regs  = c -> regs;
+    int64_t          start = c -> cycles;
+    int64_t          end   = start + cycle_budget;
+    c -> run_end           = end;
+
+    while (c -> cycles < stop_cycle(c, end))
     {
-        uint16_t location  = 0;
-        int    op        = (enum operation_2)((opcode & OPERATION_MASK) >> OPERATION_SHIFT);
-        int    addr_mode = (enum addr_mode_2)((opcode & ADDR_MODE_MASK) >> ADDR_MODE_SHIFT);
-        switch (addr_mode)
+        // Skip the remaining cycles of the current instruction in one go
+        if (c -> skip_cycles > 1)
         {
-            case Immediate_:
-                location = c -> PC++;
-                break;
-            case ZeroPage_:
-                location = bus_read(c -> bus,c -> PC++);
-                break;
-            case Accumulator:
-                break;
-            case Absolute_:
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                break;
-            case Indexed:
-            {
-                location = bus_read(c -> bus,c -> PC++);
-                uint8_t index;
-                if (op == LDX || op == STX)
-                    index = c -> Y;
-                else
-                    index = c -> X;
-                // The mask wraps address around zero page
-                location = (location + index) & 0xff;
-            }
-                break;
-            case AbsoluteIndexed:
-            {
-                location  = read_address(c, c -> PC);
-                c -> PC     += 2;
-                uint8_t index;
-                if (op == LDX || op == STX)
-                    index = c -> Y;
-                else
-                    index = c -> X;
-                skipPageCrossCycle(c, location, location + index);
-                location += index;
-            }
-                break;
-            default:
-                return false;
+            int64_t idle = c -> skip_cycles - 1;
+            if (idle > stop_cycle(c, end) - c -> cycles) idle = stop_cycle(c, end) - c -> cycles;
+            c -> skip_cycles -= idle;
+            c -> cycles      += idle;
+            continue;
         }
 
-        uint16_t operand = 0;
-        switch (op)
+        // Hand a pending interrupt back to the caller first, unless nothing has run yet
+        bool interrupt = c -> pending_NMI || (!(regs.P & FLAG_I) && c -> irq_pulldowns);
+        if (interrupt && c -> cycles > start) break;
+
+        if (debug && c -> debugger)
         {
-            case ASL:
-            case ROL:
-                if (addr_mode == Accumulator)
-                {
-                    bool prev_C   = c -> C;
-                    c -> C           = c -> A & 0x80;
-                    c -> A         <<= 1;
-                    // If Rotating, set the bit-0 to the the previous carry
-                    c -> A           = c -> A | (prev_C && (op == ROL));
-                    setZN(c, c -> A);
-                }
-                else
-                {
-                    bool prev_C = c -> C;
-                    operand     = bus_read(c -> bus,location);
-                    c -> C         = operand & 0x80;
-                    operand     = operand << 1 | (prev_C && (op == ROL));
-                    setZN(c, operand);
-                    bus_write(c -> bus,location, operand);
-                }
-                break;
-            case LSR:
-            case ROR:
-                if (addr_mode == Accumulator)
-                {
-                    bool prev_C   = c -> C;
-                    c -> C           = c -> A & 1;
-                    c -> A         >>= 1;
-                    // If Rotating, set the bit-7 to the previous carry
-                    c -> A           = c -> A | (prev_C && (op == ROR)) << 7;
-                    setZN(c, c -> A);
-                }
-                else
-                {
-                    bool prev_C = c -> C;
-                    operand     = bus_read(c -> bus,location);
-                    c -> C         = operand & 1;
-                    operand     = operand >> 1 | (prev_C && (op == ROR)) << 7;
-                    setZN(c, operand);
-                    bus_write(c -> bus,location, operand);
-                }
-                break;
-            case STX:
-                bus_write(c -> bus,location, c -> X);
-                break;
-            case LDX:
-                c -> X = bus_read(c -> bus,location);
-                setZN(c, c -> X);
-                break;
-            case DEC:
-            {
-                uint8_t tmp = bus_read(c -> bus,location) - 1;
-                setZN(c, tmp);
-                bus_write(c -> bus,location, tmp);
-            }
-                break;
-            case INC:
+            if (debugger_hit(c -> debugger)) break;
+            struct DecodedInstruction scratch;
+            if (!interrupt && debugger_instruction(c -> debugger, &regs, lookup(c, regs.PC, &scratch))) break;
+        }
+
+        ++c -> cycles;
+        c -> skip_cycles = 0;
+#ifdef CPU_DYNAREC
+        // A block only runs if its last instruction starts before the stop cycle
+        if (recompile && !interrupt)
+        {
+            int ran = dynarec_execute(c -> dynarec, c, &regs, stop_cycle(c, end) - c -> cycles + 1);
+            if (ran)
             {
-                uint8_t tmp = bus_read(c -> bus,location) + 1;
-                setZN(c, tmp);
-                bus_write(c -> bus,location, tmp);
+                c -> skip_cycles = ran;
+                continue;
             }
-                break;
-            default:
-                return false;
         }
-        return true;
+#endif
+        execute(c, &regs);
     }
-    return false;
+    expire_events(c);
+    c -> regs    = regs;
+    c -> run_end = 0;
+    return c -> cycles - start;
 }
 
-// Public
+static int64_t run_debug(cpu c, int64_t cycle_budget) { return run_loop(c, cycle_budget, false, true); }
+static int64_t run_reference(cpu c, int64_t cycle_budget) { return run_loop(c, cycle_budget, false, false); }
+#ifdef CPU_DYNAREC
+static int64_t run_recompiler(cpu c, int64_t cycle_budget) { return run_loop(c, cycle_budget, true, false); }
+#endif
+
+// Slowest first, the last one is the default
+static const struct CPUCore cpu_cores[] = {
+    { "debug",      run_debug,      false },
+    { "reference",  run_reference,  false },
+#ifdef __GNUC__
+    { "fast",       run_threaded,   true  },
+#endif
+#ifdef CPU_DYNAREC
+    { "recompiler", run_recompiler, true  },
+#endif
+};
+
+#define CPU_CORES_SIZE ((int)(sizeof(cpu_cores) / sizeof(cpu_cores[0])))
+
+static const struct CPUCore* default_core = &cpu_cores[CPU_CORES_SIZE - 1];
+
+int64_t cpu_run(cpu c, int64_t cycle_budget){
+    return c -> core -> run(c, cycle_budget);
+}
+
+const struct CPUCore* cpu_core(int index){
+    return index >= 0 && index < CPU_CORES_SIZE ? &cpu_cores[index] : NULL;
+}
+
+const struct CPUCore* cpu_find_core(const char* name){
+    for (int i = 0; i < CPU_CORES_SIZE; ++i)
+        if (!strcmp(cpu_cores[i].name, name)) return &cpu_cores[i];
+    return NULL;
+}
+
+void cpu_set_core(cpu c, const struct CPUCore* core){
+    c -> core = core;
+}
+
+void cpu_use_mapper(cpu c, mapper m){
+#if defined(CPU_MAPPER_CORES) && defined(__GNUC__)
+    const struct CPUCore* fast    = cpu_find_core("fast");
+    bool                  on_fast = c -> core == fast;
+    for (int i = 0; i < MAPPER_CORES_SIZE; ++i)
+        if (c -> core == &mapper_cores[i].core) on_fast = true;
+    // Any other tier was picked on purpose
+    if (!on_fast) return;
+
+    c -> core = fast;
+    for (int i = 0; i < MAPPER_CORES_SIZE; ++i)
+        if (mapper_cores[i].type == m -> m_type) c -> core = &mapper_cores[i].core;
+    c -> flat_prg      = m -> cart -> prg_rom;
+    c -> flat_prg_mask = m -> prg_size - 1;
+#else
+    (void)c; (void)m;
+#endif
+}
+
+void cpu_set_default_core(const struct CPUCore* core){
+    default_core = core;
+}
 
 void cpu_init(cpu c, bus b){
     c -> bus = b;
@@ -560,57 +577,56 @@ void cpu_init(cpu c, bus b){
     c -> irq_handlers = malloc(4 * sizeof(struct IRQHandler)); // capacità iniziale
     c -> irq_handlers_size = 0;
     c -> irq_handlers_capacity = 4;
+    c -> events_size = 0;
+    c -> next_event = CPU_NO_EVENT;
+    c -> run_end = 0;
+    c -> idle_skipped_cycles = 0;
+    c -> idle_branch = -1;
+    memset(c -> fusion_runs, 0, sizeof(c -> fusion_runs));
+    memset(c -> fusion_cycles, 0, sizeof(c -> fusion_cycles));
+    c -> decode_cache = calloc(DECODE_CACHE_SIZE, sizeof(struct DecodedInstruction));
+    if (!c -> decode_cache) exit(EXIT_FAILURE);
+    set_code_write_callback(b, code_written, c);
+    c -> core = default_core;
+    c -> debugger = NULL;
+#ifdef CPU_DYNAREC
+    c -> dynarec = dynarec_create();
+#endif
 }
 
-uint16_t read_address(cpu c, uint16_t addr){
-    return bus_read(c -> bus, addr) | bus_read(c -> bus, addr + 1) << 8;
-}
-
-void cpu_step(cpu c){
-    ++c -> cycles;
-    if(c -> skip_cycles-- > 1) return;
-    c -> skip_cycles = 0;
+#ifdef CPU_DYNAREC
+int cpu_interpret(cpu c, registers r){
+    int before = c -> skip_cycles;
 
-    if(c -> pending_NMI){
-        interrupt_sequence(c, NMI);
-        c -> pending_NMI = false;
-        return;
-    }else if(is_pending_IRQ(c)){
-        interrupt_sequence(c, IRQ);
-        return;
-    }
+    TRACE_INSTRUCTION(c, r);
 
-    int psw = c -> N << 7 | c -> V << 6 | 1 << 5 | c -> D << 3 | c -> I << 2 | c -> Z << 1 | c -> C;
-    printf(
-            "%04X  %02X  A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%3d",
-            c -> PC, bus_read(c -> bus, c -> PC),
-            c -> A, c -> X, c -> Y, psw, c -> SP,
-            ((c -> cycles - 1) * 3) % 341
-    );
+    struct DecodedInstruction        scratch;
+    const struct DecodedInstruction* d = fetch(c, r, &scratch);
 
-    uint8_t opcode = bus_read(c -> bus, c -> PC++);
-
-    uint8_t cycle_lenght = operation_cycles[opcode];
-
-    if (cycle_lenght && (execute_implied(c, opcode) || execute_branch(c, opcode) || execute_type1(c, opcode) ||
-                         execute_type2(c, opcode) || execute_type0(c, opcode))) {
-        c -> skip_cycles += cycle_lenght;
-    } else {
-        perror("Unrecognized opcode: 0x%04X", opcode);
+    const struct Opcode* op = &dispatch_table[d -> opcode];
+    if (!op -> cycles) {
+        perror("Unrecognized opcode: 0x%04X", d -> opcode);
+        return 0;
     }
+    op -> handler(c, r, d -> operand);
+
+    int ran = c -> skip_cycles - before;
+    c -> skip_cycles = before;
+    return ran;
 }
+#endif
 
 void cpu_reset(cpu c){
     cpu_addr_reset(c, read_address(c, RESET_VECTOR));
 }
 
 void cpu_addr_reset(cpu c, uint16_t start_addr){
+    registers r = &c -> regs;
     c -> skip_cycles = c -> cycles             = 0;
-    c -> A = c -> X = c -> Y                   = 0;
-    c -> I                                     = true;
-    c -> C = c -> D = c -> N = c -> V = c -> Z = false;
-    c -> PC                                    = start_addr;
-    c -> SP                                    = 0xfd; // documented startup state
+    r -> A = r -> X = r -> Y                   = 0;
+    set_P(r, FLAG_I);
+    r -> PC                                    = start_addr;
+    r -> SP                                    = 0xfd; // documented startup state
 }
 
 void skip_OAM_DMA_cycles(cpu c){
@@ -625,6 +641,71 @@ void nmi_interrupt(cpu c){
     c -> pending_NMI = true;
 }
 
+int cpu_register_event(cpu c){
+    if (c -> events_size >= CPU_MAX_EVENTS) {
+        perror("Too many CPU events");
+        exit(EXIT_FAILURE);
+    }
+    c -> events[c -> events_size] = CPU_NO_EVENT;
+    return c -> events_size++;
+}
+
+void cpu_schedule_event(cpu c, int event, int64_t cycle){
+    c -> events[event] = cycle;
+    update_next_event(c);
+}
+
+void cpu_cancel_event(cpu c, int event){
+    c -> events[event] = CPU_NO_EVENT;
+    update_next_event(c);
+}
+
+const char* cpu_fusion_name(enum Fusion fusion){
+    switch (fusion)
+    {
+        case FUSION_DEX_BNE:            return "DEX/BNE";
+        case FUSION_INY_CPY_IMM_BNE:    return "INY/CPY #/BNE";
+        case FUSION_INY_CPY_ZP_BNE:     return "INY/CPY zp/BNE";
+        case FUSION_LDA_STA_ZP:         return "LDA/STA zp";
+        case FUSION_LDA_PPU_STATUS_BPL: return "LDA $2002/BPL";
+        default:                        return "none";
+    }
+}
+
+const struct Opcode* cpu_opcode(uint8_t opcode){
+    return &dispatch_table[opcode];
+}
+
+int cpu_disassemble(uint16_t pc, const uint8_t* bytes, char* buffer, size_t size){
+    static const char* const operation_names[] = {
+        "???",
+#define OPERATION_NAME(operation) #operation,
+        CPU_OPERATIONS(OPERATION_NAME)
+#undef OPERATION_NAME
+    };
+    static const char* const operand_formats[] = {
+#define OPERAND_FORMAT(mode, length, format) format,
+        CPU_ADDRESSING_MODES(OPERAND_FORMAT)
+#undef OPERAND_FORMAT
+    };
+
+    const struct Opcode* op = &dispatch_table[bytes[0]];
+    if (!op -> cycles) {
+        snprintf(buffer, size, ".byte $%02X", bytes[0]);
+        return 1;
+    }
+
+    uint16_t operand = 0;
+    if (op -> length > 1) operand  = bytes[1];
+    if (op -> length > 2) operand |= bytes[2] << 8;
+    if (op -> addressing == MODE_RELATIVE) operand = pc + 2 + (int8_t)bytes[1];
+
+    int written = snprintf(buffer, size, "%s", operation_names[op -> operation]);
+    if (written > 0 && (size_t)written < size)
+        snprintf(buffer + written, size - written, operand_formats[op -> addressing], operand);
+    return op -> length;
+}
+
 void add_irq_handler(cpu c, int bit) {
     if (c -> irq_handlers_size >= c -> irq_handlers_capacity) {
         c -> irq_handlers_capacity *= 2;
@@ -645,6 +726,6 @@ irq_handle create_IRQ_handler(cpu c){
 }
 
 void set_IRQ_pulldown(cpu c, int bit, bool state){
-    int mask           = ~(1 << bit);
-    c -> irq_pulldowns = (c -> irq_pulldowns & mask) | state;
+    // bit is the handler's mask, each source holds the line on its own
+    c -> irq_pulldowns = (c -> irq_pulldowns & ~bit) | (state ? bit : 0);
 }
\ No newline at end of file
@@ -0,0 +1,481 @@
+// Instruction handlers and the fast tier. Not compiled on its own: cpu.c includes it once
+// for every build of them it needs, after defining
+//   CORE(name)          the name each function gets in that build
+//   CORE_READ(c, addr)  the memory read the handlers use
+// The stack, interrupts and decoding stay in cpu.c and are shared by all of them.
+
+// Addressing mode handlers: PC already points past the instruction,
+// the operand bytes come from the decode cache. They return the effective address
+
+static uint16_t CORE(addr_implied)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)r; (void)operand; (void)page_penalty;
+    return 0;
+}
+
+static uint16_t CORE(addr_immediate)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)operand; (void)page_penalty;
+    return r -> PC - 1;
+}
+
+static uint16_t CORE(addr_zero_page)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)r; (void)page_penalty;
+    return operand;
+}
+
+static uint16_t CORE(addr_zero_page_x)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)page_penalty;
+    // Address wraps around in the zero page
+    return (operand + r -> X) & 0xff;
+}
+
+static uint16_t CORE(addr_zero_page_y)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)page_penalty;
+    return (operand + r -> Y) & 0xff;
+}
+
+static uint16_t CORE(addr_absolute)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)r; (void)page_penalty;
+    return operand;
+}
+
+static uint16_t CORE(addr_absolute_x)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    if (page_penalty)
+        skipPageCrossCycle(c, operand, operand + r -> X);
+    return operand + r -> X;
+}
+
+static uint16_t CORE(addr_absolute_y)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    if (page_penalty)
+        skipPageCrossCycle(c, operand, operand + r -> Y);
+    return operand + r -> Y;
+}
+
+static uint16_t CORE(addr_indexed_indirect_x)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)page_penalty;
+    uint8_t zero_addr = r -> X + operand;
+    // Addresses wrap in zero page mode, thus pass through a mask
+    return CORE_READ(c, zero_addr & 0xff) | CORE_READ(c, (zero_addr + 1) & 0xff) << 8;
+}
+
+static uint16_t CORE(addr_indirect_y)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    uint8_t zero_addr = operand;
+    uint16_t location = CORE_READ(c, zero_addr & 0xff) | CORE_READ(c, (zero_addr + 1) & 0xff) << 8;
+    if (page_penalty)
+        skipPageCrossCycle(c, location, location + r -> Y);
+    return location + r -> Y;
+}
+
+static uint16_t CORE(addr_indirect)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)r; (void)page_penalty;
+    uint16_t Page = operand & 0xff00;
+    // The high byte is fetched without carrying into the next page (6502 JMP bug)
+    return CORE_READ(c, operand) | CORE_READ(c, Page | ((operand + 1) & 0xff)) << 8;
+}
+
+static uint16_t CORE(addr_relative)(cpu c, registers r, uint16_t operand, bool page_penalty){
+    (void)c; (void)operand; (void)page_penalty;
+    return r -> PC - 1;
+}
+
+// Operation handlers: execute the instruction on the effective address
+
+static void CORE(branch)(cpu c, registers r, uint16_t location, bool condition){
+    if (condition) take_branch(c, r, CORE_READ(c, location), location - 1);
+}
+
+static void CORE(compare)(cpu c, registers r, uint8_t reg, uint16_t location){
+    uint16_t diff = reg - CORE_READ(c, location);
+    set_flag(r, FLAG_C, !(diff & 0x100));
+    setZN(r, diff);
+}
+
+static void CORE(op_nop)(cpu c, registers r, uint16_t location) { (void)c; (void)r; (void)location; }
+static void CORE(op_brk)(cpu c, registers r, uint16_t location) { (void)location; interrupt_sequence(c, r, BRK_); }
+
+static void CORE(op_jsr)(cpu c, registers r, uint16_t location){
+    // The pushed return address is the last byte of the JSR instruction
+    push_stack(c, r, (uint8_t)((r -> PC - 1) >> 8));
+    push_stack(c, r, (uint8_t)(r -> PC - 1));
+    r -> PC = location;
+}
+
+static void CORE(op_rts)(cpu c, registers r, uint16_t location){
+    (void)location;
+    r -> PC  = pull_stack(c, r);
+    r -> PC |= pull_stack(c, r) << 8;
+    ++r -> PC;
+}
+
+static void CORE(op_plp)(cpu c, registers r, uint16_t location){
+    (void)location;
+    set_P(r, pull_stack(c, r));
+}
+
+static void CORE(op_rti)(cpu c, registers r, uint16_t location){
+    CORE(op_plp)(c, r, location);
+    r -> PC  = pull_stack(c, r);
+    r -> PC |= pull_stack(c, r) << 8;
+}
+
+static void CORE(op_jmp)(cpu c, registers r, uint16_t location){
+    uint16_t jmp_pc = r -> PC - 3;
+    r -> PC = location;
+    if (location <= jmp_pc) idle_loop_check(c, r, jmp_pc);
+}
+
+static void CORE(op_php)(cpu c, registers r, uint16_t location){
+    (void)location;
+    // PHP pushes with the B flag as 1, no matter what
+    push_stack(c, r, get_P(r) | FLAG_B);
+}
+
+static void CORE(op_pha)(cpu c, registers r, uint16_t location) { (void)location; push_stack(c, r, r -> A); }
+static void CORE(op_pla)(cpu c, registers r, uint16_t location) { (void)location; r -> A = pull_stack(c, r); setZN(r, r -> A); }
+static void CORE(op_dey)(cpu c, registers r, uint16_t location) { (void)c; (void)location; --r -> Y; setZN(r, r -> Y); }
+static void CORE(op_dex)(cpu c, registers r, uint16_t location) { (void)c; (void)location; --r -> X; setZN(r, r -> X); }
+static void CORE(op_tay)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> Y = r -> A; setZN(r, r -> Y); }
+static void CORE(op_iny)(cpu c, registers r, uint16_t location) { (void)c; (void)location; ++r -> Y; setZN(r, r -> Y); }
+static void CORE(op_inx)(cpu c, registers r, uint16_t location) { (void)c; (void)location; ++r -> X; setZN(r, r -> X); }
+static void CORE(op_clc)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P &= ~FLAG_C; }
+static void CORE(op_sec)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P |= FLAG_C; }
+static void CORE(op_cli)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P &= ~FLAG_I; }
+static void CORE(op_sei)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P |= FLAG_I; }
+static void CORE(op_cld)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P &= ~FLAG_D; }
+static void CORE(op_sed)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P |= FLAG_D; }
+static void CORE(op_tya)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> A = r -> Y; setZN(r, r -> A); }
+static void CORE(op_clv)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> P &= ~FLAG_V; }
+static void CORE(op_txa)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> A = r -> X; setZN(r, r -> A); }
+static void CORE(op_txs)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> SP = r -> X; }
+static void CORE(op_tax)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> X = r -> A; setZN(r, r -> X); }
+static void CORE(op_tsx)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> X = r -> SP; setZN(r, r -> X); }
+
+static void CORE(op_bpl)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, !flag_N(r)); }
+static void CORE(op_bmi)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, flag_N(r)); }
+static void CORE(op_bvc)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, !(r -> P & FLAG_V)); }
+static void CORE(op_bvs)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, r -> P & FLAG_V); }
+static void CORE(op_bcc)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, !(r -> P & FLAG_C)); }
+static void CORE(op_bcs)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, r -> P & FLAG_C); }
+static void CORE(op_bne)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, !flag_Z(r)); }
+static void CORE(op_beq)(cpu c, registers r, uint16_t location) { CORE(branch)(c, r, location, flag_Z(r)); }
+
+static void CORE(op_ora)(cpu c, registers r, uint16_t location) { r -> A |= CORE_READ(c, location); setZN(r, r -> A); }
+static void CORE(op_and)(cpu c, registers r, uint16_t location) { r -> A &= CORE_READ(c, location); setZN(r, r -> A); }
+static void CORE(op_eor)(cpu c, registers r, uint16_t location) { r -> A ^= CORE_READ(c, location); setZN(r, r -> A); }
+
+static void CORE(op_adc)(cpu c, registers r, uint16_t location){
+    uint8_t  operand = CORE_READ(c, location);
+    uint16_t sum     = r -> A + operand + (r -> P & FLAG_C);
+    // Carry forward or UNSIGNED overflow, then SIGNED overflow, would only
+    // happen if the sign of sum is different from BOTH the operands
+    r -> P           = (r -> P & ~(FLAG_C | FLAG_V)) | sum >> 8 |
+                       ((r -> A ^ sum) & (operand ^ sum) & 0x80) >> 1;
+    r -> A           = sum;
+    setZN(r, r -> A);
+}
+
+static void CORE(op_sta)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, r -> A); }
+static void CORE(op_lda)(cpu c, registers r, uint16_t location) { r -> A = CORE_READ(c, location); setZN(r, r -> A); }
+
+static void CORE(op_sbc)(cpu c, registers r, uint16_t location){
+    uint16_t subtrahend = CORE_READ(c, location), diff = r -> A - subtrahend - !(r -> P & FLAG_C);
+    r -> P = (r -> P & ~(FLAG_C | FLAG_V)) | !(diff & 0x100) |
+             ((r -> A ^ diff) & (~subtrahend ^ diff) & 0x80) >> 1;
+    r -> A = diff;
+    setZN(r, diff);
+}
+
+static void CORE(op_cmp)(cpu c, registers r, uint16_t location) { CORE(compare)(c, r, r -> A, location); }
+static void CORE(op_cpx)(cpu c, registers r, uint16_t location) { CORE(compare)(c, r, r -> X, location); }
+static void CORE(op_cpy)(cpu c, registers r, uint16_t location) { CORE(compare)(c, r, r -> Y, location); }
+
+static void CORE(op_bit)(cpu c, registers r, uint16_t location){
+    uint8_t operand = CORE_READ(c, location);
+    // N comes from the operand, not the AND, so it goes to bit 8
+    r -> nz         = (r -> A & operand) | (operand & 0x80) << 1;
+    set_flag(r, FLAG_V, operand & 0x40);
+}
+
+static void CORE(op_sty)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, r -> Y); }
+static void CORE(op_ldy)(cpu c, registers r, uint16_t location) { r -> Y = CORE_READ(c, location); setZN(r, r -> Y); }
+static void CORE(op_stx)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, r -> X); }
+static void CORE(op_ldx)(cpu c, registers r, uint16_t location) { r -> X = CORE_READ(c, location); setZN(r, r -> X); }
+
+static void CORE(op_asl)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, shift_left(r, CORE_READ(c, location), false)); }
+static void CORE(op_rol)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, shift_left(r, CORE_READ(c, location), true)); }
+static void CORE(op_lsr)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, shift_right(r, CORE_READ(c, location), false)); }
+static void CORE(op_ror)(cpu c, registers r, uint16_t location) { bus_write(c -> bus, location, shift_right(r, CORE_READ(c, location), true)); }
+static void CORE(op_asl_acc)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> A = shift_left(r, r -> A, false); }
+static void CORE(op_rol_acc)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> A = shift_left(r, r -> A, true); }
+static void CORE(op_lsr_acc)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> A = shift_right(r, r -> A, false); }
+static void CORE(op_ror_acc)(cpu c, registers r, uint16_t location) { (void)c; (void)location; r -> A = shift_right(r, r -> A, true); }
+
+static void CORE(op_dec)(cpu c, registers r, uint16_t location){
+    uint8_t tmp = CORE_READ(c, location) - 1;
+    setZN(r, tmp);
+    bus_write(c -> bus, location, tmp);
+}
+
+static void CORE(op_inc)(cpu c, registers r, uint16_t location){
+    uint8_t tmp = CORE_READ(c, location) + 1;
+    setZN(r, tmp);
+    bus_write(c -> bus, location, tmp);
+}
+
+// Opcode handlers, one per CPU_OPCODES entry. Mode, page penalty and cycles are constants
+// in each of them, so CORE(address)() and CORE(operate)() fold down to the two handlers they pick.
+
+static inline __attribute__((always_inline))
+uint16_t CORE(address)(cpu c, registers r, enum AddressingMode mode, uint16_t operand, bool page_penalty){
+    switch (mode)
+    {
+        case MODE_IMPLIED:
+        case MODE_ACCUMULATOR:        return CORE(addr_implied)(c, r, operand, page_penalty);
+        case MODE_IMMEDIATE:          return CORE(addr_immediate)(c, r, operand, page_penalty);
+        case MODE_ZERO_PAGE:          return CORE(addr_zero_page)(c, r, operand, page_penalty);
+        case MODE_ZERO_PAGE_X:        return CORE(addr_zero_page_x)(c, r, operand, page_penalty);
+        case MODE_ZERO_PAGE_Y:        return CORE(addr_zero_page_y)(c, r, operand, page_penalty);
+        case MODE_ABSOLUTE:           return CORE(addr_absolute)(c, r, operand, page_penalty);
+        case MODE_ABSOLUTE_X:         return CORE(addr_absolute_x)(c, r, operand, page_penalty);
+        case MODE_ABSOLUTE_Y:         return CORE(addr_absolute_y)(c, r, operand, page_penalty);
+        case MODE_INDEXED_INDIRECT_X: return CORE(addr_indexed_indirect_x)(c, r, operand, page_penalty);
+        case MODE_INDIRECT_Y:         return CORE(addr_indirect_y)(c, r, operand, page_penalty);
+        case MODE_INDIRECT:           return CORE(addr_indirect)(c, r, operand, page_penalty);
+        case MODE_RELATIVE:           return CORE(addr_relative)(c, r, operand, page_penalty);
+    }
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+void CORE(operate)(cpu c, registers r, enum Operation operation, enum AddressingMode mode, uint16_t location){
+    bool accumulator = mode == MODE_ACCUMULATOR;
+    switch (operation)
+    {
+        case OP_ADC: CORE(op_adc)(c, r, location); break;
+        case OP_AND: CORE(op_and)(c, r, location); break;
+        case OP_ASL: accumulator ? CORE(op_asl_acc)(c, r, location) : CORE(op_asl)(c, r, location); break;
+        case OP_BCC: CORE(op_bcc)(c, r, location); break;
+        case OP_BCS: CORE(op_bcs)(c, r, location); break;
+        case OP_BEQ: CORE(op_beq)(c, r, location); break;
+        case OP_BIT: CORE(op_bit)(c, r, location); break;
+        case OP_BMI: CORE(op_bmi)(c, r, location); break;
+        case OP_BNE: CORE(op_bne)(c, r, location); break;
+        case OP_BPL: CORE(op_bpl)(c, r, location); break;
+        case OP_BRK: CORE(op_brk)(c, r, location); break;
+        case OP_BVC: CORE(op_bvc)(c, r, location); break;
+        case OP_BVS: CORE(op_bvs)(c, r, location); break;
+        case OP_CLC: CORE(op_clc)(c, r, location); break;
+        case OP_CLD: CORE(op_cld)(c, r, location); break;
+        case OP_CLI: CORE(op_cli)(c, r, location); break;
+        case OP_CLV: CORE(op_clv)(c, r, location); break;
+        case OP_CMP: CORE(op_cmp)(c, r, location); break;
+        case OP_CPX: CORE(op_cpx)(c, r, location); break;
+        case OP_CPY: CORE(op_cpy)(c, r, location); break;
+        case OP_DEC: CORE(op_dec)(c, r, location); break;
+        case OP_DEX: CORE(op_dex)(c, r, location); break;
+        case OP_DEY: CORE(op_dey)(c, r, location); break;
+        case OP_EOR: CORE(op_eor)(c, r, location); break;
+        case OP_INC: CORE(op_inc)(c, r, location); break;
+        case OP_INX: CORE(op_inx)(c, r, location); break;
+        case OP_INY: CORE(op_iny)(c, r, location); break;
+        case OP_JMP: CORE(op_jmp)(c, r, location); break;
+        case OP_JSR: CORE(op_jsr)(c, r, location); break;
+        case OP_LDA: CORE(op_lda)(c, r, location); break;
+        case OP_LDX: CORE(op_ldx)(c, r, location); break;
+        case OP_LDY: CORE(op_ldy)(c, r, location); break;
+        case OP_LSR: accumulator ? CORE(op_lsr_acc)(c, r, location) : CORE(op_lsr)(c, r, location); break;
+        case OP_NOP: CORE(op_nop)(c, r, location); break;
+        case OP_ORA: CORE(op_ora)(c, r, location); break;
+        case OP_PHA: CORE(op_pha)(c, r, location); break;
+        case OP_PHP: CORE(op_php)(c, r, location); break;
+        case OP_PLA: CORE(op_pla)(c, r, location); break;
+        case OP_PLP: CORE(op_plp)(c, r, location); break;
+        case OP_ROL: accumulator ? CORE(op_rol_acc)(c, r, location) : CORE(op_rol)(c, r, location); break;
+        case OP_ROR: accumulator ? CORE(op_ror_acc)(c, r, location) : CORE(op_ror)(c, r, location); break;
+        case OP_RTI: CORE(op_rti)(c, r, location); break;
+        case OP_RTS: CORE(op_rts)(c, r, location); break;
+        case OP_SBC: CORE(op_sbc)(c, r, location); break;
+        case OP_SEC: CORE(op_sec)(c, r, location); break;
+        case OP_SED: CORE(op_sed)(c, r, location); break;
+        case OP_SEI: CORE(op_sei)(c, r, location); break;
+        case OP_STA: CORE(op_sta)(c, r, location); break;
+        case OP_STX: CORE(op_stx)(c, r, location); break;
+        case OP_STY: CORE(op_sty)(c, r, location); break;
+        case OP_TAX: CORE(op_tax)(c, r, location); break;
+        case OP_TAY: CORE(op_tay)(c, r, location); break;
+        case OP_TSX: CORE(op_tsx)(c, r, location); break;
+        case OP_TXA: CORE(op_txa)(c, r, location); break;
+        case OP_TXS: CORE(op_txs)(c, r, location); break;
+        case OP_TYA: CORE(op_tya)(c, r, location); break;
+        case OP_NONE: break;
+    }
+}
+
+#define OPCODE_HANDLER(opcode, operation, mode, cycles, page_penalty, access)                  \
+    static void CORE(opcode_##opcode)(cpu c, registers r, uint16_t operand){                   \
+        uint16_t location = CORE(address)(c, r, MODE_##mode, operand, page_penalty);           \
+        CORE(operate)(c, r, OP_##operation, MODE_##mode, location);                            \
+        c -> skip_cycles += cycles;                                                            \
+    }
+CPU_OPCODES(OPCODE_HANDLER)
+#undef OPCODE_HANDLER
+
+// Runs the superinstruction d starts, PC is past its first instruction.
+// Each part has the same effects and cycles as the interpreter handlers.
+static void CORE(execute_fused)(cpu c, registers r, const struct DecodedInstruction* d){
+    int     start = c -> skip_cycles;
+    int64_t idle  = c -> idle_skipped_cycles;
+
+    switch (d -> fusion)
+    {
+        case FUSION_DEX_BNE:
+            CORE(op_dex)(c, r, 0);
+            c -> skip_cycles += 2;
+            if (!fusion_continues(c, r)) return;
+            r -> PC += 2;
+            if (!flag_Z(r)) take_branch(c, r, d -> fused_operand, r -> PC - 2);
+            c -> skip_cycles += 2;
+            break;
+        case FUSION_INY_CPY_IMM_BNE:
+        case FUSION_INY_CPY_ZP_BNE:
+        {
+            bool zero_page = d -> fusion == FUSION_INY_CPY_ZP_BNE;
+            CORE(op_iny)(c, r, 0);
+            c -> skip_cycles += 2;
+            if (!fusion_continues(c, r)) return;
+            r -> PC += 2;
+            uint8_t  operand = d -> fused_operand;
+            uint16_t diff    = r -> Y - (zero_page ? CORE_READ(c, operand) : operand);
+            set_flag(r, FLAG_C, !(diff & 0x100));
+            setZN(r, diff);
+            c -> skip_cycles += zero_page ? 3 : 2;
+            if (!fusion_continues(c, r)) return;
+            r -> PC += 2;
+            if (!flag_Z(r)) take_branch(c, r, d -> fused_operand >> 8, r -> PC - 2);
+            c -> skip_cycles += 2;
+            break;
+        }
+        case FUSION_LDA_STA_ZP:
+            r -> A = d -> opcode == OPCODE_LDA_IMMEDIATE ? d -> operand : CORE_READ(c, d -> operand);
+            setZN(r, r -> A);
+            c -> skip_cycles += dispatch_table[d -> opcode].cycles;
+            if (!fusion_continues(c, r)) return;
+            r -> PC += 2;
+            bus_write(c -> bus, d -> fused_operand, r -> A);
+            c -> skip_cycles += 3;
+            break;
+        case FUSION_LDA_PPU_STATUS_BPL:
+            // The read syncs the PPU, an NMI it raises is taken before the BPL
+            r -> A = CORE_READ(c, PPU_STATUS);
+            setZN(r, r -> A);
+            c -> skip_cycles += 4;
+            if (!fusion_continues(c, r)) return;
+            r -> PC += 2;
+            if (!flag_N(r)) take_branch(c, r, d -> fused_operand, r -> PC - 2);
+            c -> skip_cycles += 2;
+            break;
+        default:
+            return;
+    }
+    ++c -> fusion_runs[d -> fusion];
+    c -> fusion_cycles[d -> fusion] += c -> skip_cycles - start - (c -> idle_skipped_cycles - idle);
+}
+
+#ifdef __GNUC__
+
+// Fast tier, a threaded interpreter: every opcode has a label that ends with its own copy
+// of the dispatch, so the host branch predictor sees one indirect jump per 6502 opcode.
+// Needs gcc/clang labels-as-values.
+static int64_t CORE(run_threaded)(cpu c, int64_t cycle_budget){
+    static void* const labels[0x100] = {
+#define OPCODE_LABEL_ADDRESS(opcode, operation, mode, cycles, page_penalty, access) [opcode] = &&L_##opcode,
+        CPU_OPCODES(OPCODE_LABEL_ADDRESS)
+#undef OPCODE_LABEL_ADDRESS
+    };
+
+    struct Registers     regs  = c -> regs;
+    registers            r     = &regs;
+    int64_t              start = c -> cycles;
+    int64_t              end   = start + cycle_budget;
+    c -> run_end               = end;
+    uint8_t              opcode;
+    struct DecodedInstruction        scratch;
+    const struct DecodedInstruction* decoded;
+
+// Fast path: the previous instruction ends before the stop cycle and no interrupt is pending,
+// so its remaining cycles and the fetch cycle of the next one are consumed at once.
+#define NEXT_INSTRUCTION()                                                                     \
+    do {                                                                                       \
+        if (c -> cycles + c -> skip_cycles > stop_cycle(c, end) ||                             \
+            c -> pending_NMI || (!(r -> P & FLAG_I) && c -> irq_pulldowns))                    \
+            goto boundary;                                                                     \
+        c -> cycles      += c -> skip_cycles;                                                  \
+        c -> skip_cycles  = 0;                                                                 \
+        TRACE_INSTRUCTION(c, r);                                                               \
+        decoded = fetch(c, r, &scratch);                                                       \
+        if (decoded -> fusion) goto fused;                                                     \
+        opcode  = decoded -> opcode;                                                           \
+        if (!labels[opcode]) goto illegal;                                                     \
+        goto *labels[opcode];                                                                  \
+    } while (0)
+
+#define OPCODE_LABEL(opcode, operation, mode, cycles, page_penalty, access)                    \
+    L_##opcode:                                                                                \
+        CORE(opcode_##opcode)(c, r, decoded -> operand);                                       \
+        NEXT_INSTRUCTION();
+
+boundary:
+    // Slow path, same steps as cpu_step
+    while (c -> cycles < stop_cycle(c, end))
+    {
+        if (c -> skip_cycles > 1)
+        {
+            int64_t idle = c -> skip_cycles - 1;
+            if (idle > stop_cycle(c, end) - c -> cycles) idle = stop_cycle(c, end) - c -> cycles;
+            c -> skip_cycles -= idle;
+            c -> cycles      += idle;
+            continue;
+        }
+
+        // Hand a pending interrupt back to the caller first, unless nothing has run yet
+        bool interrupt = c -> pending_NMI || (!(r -> P & FLAG_I) && c -> irq_pulldowns);
+        if (interrupt && c -> cycles > start) break;
+
+        ++c -> cycles;
+        c -> skip_cycles = 0;
+
+        if (interrupt)
+        {
+            service_interrupt(c, r);
+            continue;
+        }
+
+        TRACE_INSTRUCTION(c, r);
+        decoded = fetch(c, r, &scratch);
+        if (decoded -> fusion) goto fused;
+        opcode  = decoded -> opcode;
+        if (!labels[opcode]) goto illegal;
+        goto *labels[opcode];
+    }
+    expire_events(c);
+    c -> regs    = regs;
+    c -> run_end = 0;
+    return c -> cycles - start;
+
+illegal:
+    perror("Unrecognized opcode: 0x%04X", opcode);
+    goto boundary;
+
+fused:
+    CORE(execute_fused)(c, r, decoded);
+    NEXT_INSTRUCTION();
+
+    CPU_OPCODES(OPCODE_LABEL)
+
+#undef NEXT_INSTRUCTION
+#undef OPCODE_LABEL
+}
+
+#endif
+
+#undef CORE
+#undef CORE_READ
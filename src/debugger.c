@@ -0,0 +1,121 @@
+#include "headers/debugger.h"
+
+static struct { uint16_t addr; uint8_t kinds; } start_watches[DEBUGGER_MAX_START];
+static int start_watches_size = 0;
+
+// Called by the bus on watched reads and writes, the CPU stops after the instruction
+static void watch_hit(void* owner, uint16_t addr, uint8_t kind, uint8_t value){
+    debugger d = (debugger)owner;
+    if (d -> hit) return;
+    d -> hit       = true;
+    d -> hit_kind  = kind;
+    d -> hit_addr  = addr;
+    d -> hit_value = value;
+    d -> hit_PC    = d -> history_size ? d -> history[(d -> history_next + DEBUGGER_HISTORY - 1) % DEBUGGER_HISTORY].PC
+                                       : d -> cpu -> regs.PC;
+}
+
+debugger debugger_create(cpu c){
+    debugger d = (debugger)calloc(1, sizeof(struct Debugger));
+    if (!d) {
+        perror("Error allocating debugger");
+        exit(EXIT_FAILURE);
+    }
+    d -> cpu = c;
+    c -> debugger = d;
+    set_watch_callback(c -> bus, watch_hit, d);
+
+    for (int i = 0; i < start_watches_size; ++i)
+        debugger_watch(d, start_watches[i].addr, start_watches[i].kinds);
+    return d;
+}
+
+void debugger_watch_at_start(uint16_t addr, uint8_t kinds){
+    if (start_watches_size >= DEBUGGER_MAX_START) {
+        perror("Too many watchpoints, 0x%04X ignored", addr);
+        return;
+    }
+    start_watches[start_watches_size].addr  = addr;
+    start_watches[start_watches_size].kinds = kinds;
+    ++start_watches_size;
+}
+
+static void set_watch(debugger d, uint16_t addr, uint8_t kinds){
+    bus     b      = d -> cpu -> bus;
+    uint8_t before = b -> watch ? b -> watch[addr] : 0;
+    if (kinds == before) return;
+    bus_set_watch(b, addr, kinds);
+
+    // The debug tier runs only while something is armed
+    if (b -> watches && d -> cpu -> core != cpu_find_core("debug")) {
+        d -> resume_core = d -> cpu -> core;
+        cpu_set_core(d -> cpu, cpu_find_core("debug"));
+    } else if (!b -> watches && d -> resume_core) {
+        cpu_set_core(d -> cpu, d -> resume_core);
+        d -> resume_core = NULL;
+    }
+}
+
+void debugger_watch(debugger d, uint16_t addr, uint8_t kinds){
+    bus b = d -> cpu -> bus;
+    set_watch(d, addr, (b -> watch ? b -> watch[addr] : 0) | kinds);
+}
+
+void debugger_unwatch(debugger d, uint16_t addr, uint8_t kinds){
+    bus b = d -> cpu -> bus;
+    set_watch(d, addr, (b -> watch ? b -> watch[addr] : 0) & ~kinds);
+}
+
+bool debugger_instruction(debugger d, registers r, const struct DecodedInstruction* decoded){
+    bus b = d -> cpu -> bus;
+    if (b -> watch && (b -> watch[r -> PC] & WATCH_EXECUTE) && !d -> resuming) {
+        d -> hit      = true;
+        d -> hit_kind = WATCH_EXECUTE;
+        d -> hit_addr = d -> hit_PC = r -> PC;
+        return true;
+    }
+    d -> resuming = false;
+
+    struct DebuggerTrace* t = &d -> history[d -> history_next];
+    t -> PC       = r -> PC;
+    t -> bytes[0] = decoded -> opcode;
+    t -> bytes[1] = decoded -> operand;
+    t -> bytes[2] = decoded -> operand >> 8;
+    t -> A  = r -> A;
+    t -> X  = r -> X;
+    t -> Y  = r -> Y;
+    t -> P  = get_P(r);
+    t -> SP = r -> SP;
+    d -> history_next = (d -> history_next + 1) % DEBUGGER_HISTORY;
+    if (d -> history_size < DEBUGGER_HISTORY) ++d -> history_size;
+    return false;
+}
+
+void debugger_dump(debugger d){
+    static const char* const kinds[] = { [WATCH_READ] = "read", [WATCH_WRITE] = "write", [WATCH_EXECUTE] = "execute" };
+    registers r = &d -> cpu -> regs;
+
+    if (d -> hit_kind == WATCH_EXECUTE)
+        printf("Breakpoint at $%04X, cycle %lld", d -> hit_addr, (long long)d -> cpu -> cycles);
+    else
+        printf("Watchpoint: %s $%02X at $%04X by the instruction at $%04X, cycle %lld",
+               kinds[d -> hit_kind], d -> hit_value, d -> hit_addr, d -> hit_PC, (long long)d -> cpu -> cycles);
+    printf("PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X", r -> PC, r -> A, r -> X, r -> Y, get_P(r), r -> SP);
+
+    // Oldest first, registers as they were before each instruction ran
+    printf("Last %d instructions:", d -> history_size);
+    for (int i = 0; i < d -> history_size; ++i) {
+        const struct DebuggerTrace* t = &d -> history[(d -> history_next + DEBUGGER_HISTORY - d -> history_size + i) % DEBUGGER_HISTORY];
+        char assembly[32];
+        int  length = cpu_disassemble(t -> PC, t -> bytes, assembly, sizeof(assembly));
+        char bytes[12] = "";
+        for (int j = 0; j < length; ++j) snprintf(bytes + 3 * j, sizeof(bytes) - 3 * j, "%02X ", t -> bytes[j]);
+        printf("%04X  %-9s %-14s A:%02X X:%02X Y:%02X P:%02X SP:%02X",
+               t -> PC, bytes, assembly, t -> A, t -> X, t -> Y, t -> P, t -> SP);
+    }
+}
+
+void debugger_resume(debugger d){
+    d -> resuming = d -> hit && d -> hit_kind == WATCH_EXECUTE;
+    d -> hit      = false;
+}
@@ -0,0 +1,812 @@
+#include "headers/dynarec.h"
+#include "headers/CPUopcodes.h"
+
+#include <sys/mman.h>
+
+#if !defined(__x86_64__)
+#error "The dynarec emits x86-64 code"
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Decoded 6502 instruction, only what the translator needs
+
+struct Instruction{
+    uint8_t               opcode;
+    enum Operation        op;           // OP_NONE when it is left to the interpreter
+    enum AddressingMode   mode;
+    enum Access           access;
+    uint8_t               cycles;
+    uint8_t               length;
+    bool                  page_penalty;
+    uint16_t              operand;
+};
+
+// Same table as the interpreter. Interrupt and status stack operations, JMP indirect
+// and unused opcodes stay interpreted
+static void decode_instruction(uint8_t opcode, struct Instruction* in){
+    const struct Opcode* entry = cpu_opcode(opcode);
+    in -> opcode       = opcode;
+    in -> op           = entry -> operation;
+    in -> mode         = entry -> addressing;
+    in -> access       = entry -> access;
+    in -> cycles       = entry -> cycles;
+    in -> length       = entry -> cycles ? entry -> length : 1;
+    in -> page_penalty = entry -> page_penalty;
+
+    switch (in -> op)
+    {
+        case OP_BRK: case OP_RTI: case OP_PHP: case OP_PLP:
+            in -> op = OP_NONE;
+            break;
+        case OP_JMP:
+            if (in -> mode == MODE_INDIRECT) in -> op = OP_NONE;
+            break;
+        default:
+            break;
+    }
+}
+
+// x86-64 emitter. Inside a block rbx holds the registers, r12 the RAM, r13 the bus
+// and r14d the cycles added by page crosses and taken branches.
+
+enum host_reg{ EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+enum host_cc{ CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_S = 0x8 };
+
+enum host_alu{ ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31 };
+
+#define FIELD(name) ((uint8_t)offsetof(struct Registers, name))
+
+struct Emitter{
+    uint8_t*              code;
+    size_t                size;
+
+    // Exits taken when an access turns out to be a register or mapper access
+    struct { size_t patch; uint16_t pc; int cycles; } bails[DYNAREC_MAX_BLOCK_LENGTH * 2];
+    int                   bails_size;
+};
+
+static void emit8(struct Emitter* e, uint8_t v) { e -> code[e -> size++] = v; }
+
+static void emit32(struct Emitter* e, uint32_t v){
+    for (int i = 0; i < 4; ++i) emit8(e, v >> (8 * i));
+}
+
+static void emit64(struct Emitter* e, uint64_t v){
+    for (int i = 0; i < 8; ++i) emit8(e, v >> (8 * i));
+}
+
+static uint8_t modrm(int mod, int reg, int rm) { return mod << 6 | (reg & 7) << 3 | (rm & 7); }
+
+// movzx reg, byte [rbx + field]
+static void load_field(struct Emitter* e, enum host_reg reg, uint8_t field){
+    emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, modrm(1, reg, EBX)); emit8(e, field);
+}
+
+// mov [rbx + field], reg8 (al, cl or dl)
+static void store_field(struct Emitter* e, uint8_t field, enum host_reg reg){
+    emit8(e, 0x88); emit8(e, modrm(1, reg, EBX)); emit8(e, field);
+}
+
+static void store_pc_imm(struct Emitter* e, uint16_t pc){
+    emit8(e, 0x66); emit8(e, 0xc7); emit8(e, modrm(1, 0, EBX)); emit8(e, FIELD(PC));
+    emit8(e, pc); emit8(e, pc >> 8);
+}
+
+// test byte [rbx + P], flag
+static void test_flag(struct Emitter* e, uint8_t flag){
+    emit8(e, 0xf6); emit8(e, modrm(1, 0, EBX)); emit8(e, FIELD(P)); emit8(e, flag);
+}
+
+// P = P & ~flag | (cc ? flag : 0), through r8b
+static void set_flag_cc(struct Emitter* e, enum host_cc cc, uint8_t flag){
+    int bit = __builtin_ctz(flag);
+    emit8(e, 0x41); emit8(e, 0x0f); emit8(e, 0x90 | cc); emit8(e, modrm(3, 0, 0));
+    if (bit) { emit8(e, 0x41); emit8(e, 0xc1); emit8(e, modrm(3, 4, 0)); emit8(e, bit); }
+    emit8(e, 0x80); emit8(e, modrm(1, 4, EBX)); emit8(e, FIELD(P)); emit8(e, (uint8_t)~flag);
+    emit8(e, 0x44); emit8(e, 0x08); emit8(e, modrm(1, 0, EBX)); emit8(e, FIELD(P));
+}
+
+static void store_flag(struct Emitter* e, uint8_t flag, bool value){
+    emit8(e, 0x80); emit8(e, modrm(1, value ? 1 : 4, EBX)); emit8(e, FIELD(P)); emit8(e, value ? flag : (uint8_t)~flag);
+}
+
+// movzx reg, byte [rbx + P] and keep C only
+static void load_carry(struct Emitter* e, enum host_reg reg){
+    load_field(e, reg, FIELD(P));
+    emit8(e, 0x83); emit8(e, modrm(3, 4, reg)); emit8(e, FLAG_C);
+}
+
+static void mov_imm(struct Emitter* e, enum host_reg reg, uint32_t value){
+    emit8(e, 0xb8 + reg); emit32(e, value);
+}
+
+static void mov_reg(struct Emitter* e, enum host_reg dst, enum host_reg src){
+    emit8(e, 0x89); emit8(e, modrm(3, src, dst));
+}
+
+static void alu_reg(struct Emitter* e, enum host_alu alu, enum host_reg dst, enum host_reg src){
+    emit8(e, alu); emit8(e, modrm(3, src, dst));
+}
+
+// The /digit of the 0x81 group is the 0x?1 opcode of the register form divided by 8
+static void alu_imm(struct Emitter* e, enum host_alu alu, enum host_reg reg, uint32_t value){
+    emit8(e, 0x81); emit8(e, modrm(3, alu >> 3, reg)); emit32(e, value);
+}
+
+static void cmp_imm(struct Emitter* e, enum host_reg reg, uint32_t value){
+    emit8(e, 0x81); emit8(e, modrm(3, 7, reg)); emit32(e, value);
+}
+
+static void test_imm(struct Emitter* e, enum host_reg reg, uint32_t value){
+    emit8(e, 0xf7); emit8(e, modrm(3, 0, reg)); emit32(e, value);
+}
+
+static void shift_imm(struct Emitter* e, bool left, enum host_reg reg, uint8_t count){
+    emit8(e, 0xc1); emit8(e, modrm(3, left ? 4 : 5, reg)); emit8(e, count);
+}
+
+// nz = low byte of reg (al, cl or dl), N and Z are worked out when read
+static void set_nz(struct Emitter* e, enum host_reg reg){
+    emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, modrm(3, reg, reg));
+    emit8(e, 0x66); emit8(e, 0x89); emit8(e, modrm(1, reg, EBX)); emit8(e, FIELD(nz));
+}
+
+// inc or dec of the low byte of reg
+static void step_byte(struct Emitter* e, enum host_reg reg, bool up){
+    emit8(e, 0xfe); emit8(e, modrm(3, up ? 0 : 1, reg));
+}
+
+// movzx reg, byte [r12 + index]
+static void load_ram(struct Emitter* e, enum host_reg reg, enum host_reg index){
+    emit8(e, 0x41); emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, modrm(0, reg, 4)); emit8(e, modrm(0, index, 4));
+}
+
+// mov [r12 + index], reg8
+static void store_ram(struct Emitter* e, enum host_reg index, enum host_reg reg){
+    emit8(e, 0x41); emit8(e, 0x88); emit8(e, modrm(0, reg, 4)); emit8(e, modrm(0, index, 4));
+}
+
+// cmp byte [r13 + index + code_marks], 0
+static void test_code_mark(struct Emitter* e, enum host_reg index){
+    emit8(e, 0x41); emit8(e, 0x80); emit8(e, modrm(2, 7, 4)); emit8(e, modrm(0, index, 5));
+    emit32(e, offsetof(struct CPUBus, code_marks)); emit8(e, 0);
+}
+
+// add r14d, reg
+static void add_penalty(struct Emitter* e, enum host_reg reg){
+    emit8(e, 0x41); emit8(e, 0x01); emit8(e, modrm(3, reg, 6));
+}
+
+static void add_penalty_imm(struct Emitter* e, uint8_t cycles){
+    emit8(e, 0x41); emit8(e, 0x83); emit8(e, modrm(3, 0, 6)); emit8(e, cycles);
+}
+
+// bus_read(b, esi) or bus_write(b, esi, edx)
+static void call_bus(struct Emitter* e, void* function){
+    emit8(e, 0x4c); emit8(e, 0x89); emit8(e, 0xef);           // mov rdi, r13
+    emit8(e, 0x48); emit8(e, 0xb8); emit64(e, (uint64_t)(uintptr_t)function);
+    emit8(e, 0xff); emit8(e, 0xd0);                           // call rax
+}
+
+// Forward jumps, patched once the target is known
+static size_t jump(struct Emitter* e){
+    emit8(e, 0xe9); emit32(e, 0);
+    return e -> size - 4;
+}
+
+static size_t jump_if(struct Emitter* e, enum host_cc cc){
+    emit8(e, 0x0f); emit8(e, 0x80 | cc); emit32(e, 0);
+    return e -> size - 4;
+}
+
+static void patch(struct Emitter* e, size_t at){
+    uint32_t rel = (uint32_t)(e -> size - (at + 4));
+    memcpy(&e -> code[at], &rel, 4);
+}
+
+static void bail_if(struct Emitter* e, enum host_cc cc, uint16_t pc, int cycles){
+    e -> bails[e -> bails_size].patch  = jump_if(e, cc);
+    e -> bails[e -> bails_size].pc     = pc;
+    e -> bails[e -> bails_size].cycles = cycles;
+    ++e -> bails_size;
+}
+
+static void prologue(struct Emitter* e){
+    static const uint8_t code[] = {
+        0x53,                   // push rbx
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x48, 0x83, 0xec, 0x08, // sub rsp, 8 (keeps calls 16-byte aligned)
+        0x48, 0x89, 0xfb,       // mov rbx, rdi
+        0x49, 0x89, 0xf4,       // mov r12, rsi
+        0x49, 0x89, 0xd5,       // mov r13, rdx
+        0x45, 0x31, 0xf6,       // xor r14d, r14d
+    };
+    for (size_t i = 0; i < sizeof(code); ++i) emit8(e, code[i]);
+}
+
+// Returns cycles + r14d, PC must already be stored
+static void epilogue(struct Emitter* e, int cycles){
+    static const uint8_t code[] = {
+        0x48, 0x83, 0xc4, 0x08, // add rsp, 8
+        0x41, 0x5e,             // pop r14
+        0x41, 0x5d,             // pop r13
+        0x41, 0x5c,             // pop r12
+        0x5b,                   // pop rbx
+        0xc3,                   // ret
+    };
+    emit8(e, 0x41); emit8(e, 0x8d); emit8(e, modrm(2, EAX, 6)); emit32(e, cycles); // lea eax, [r14 + cycles]
+    for (size_t i = 0; i < sizeof(code); ++i) emit8(e, code[i]);
+}
+
+// Where an access lands, as far as the translator can tell
+enum region{
+    REGION_RAM,
+    REGION_IO,         // $2000-$401F, interpreted
+    REGION_CARTRIDGE,  // $4020-$7FFF, through the bus
+    REGION_ROM,
+    REGION_UNKNOWN,    // decided at run time
+};
+
+static enum region static_region(uint16_t addr){
+    if (addr < 0x2000) return REGION_RAM;
+    if (addr < 0x4020) return REGION_IO;
+    if (addr < 0x8000) return REGION_CARTRIDGE;
+    return REGION_ROM;
+}
+
+// esi = address + index register. With page_penalty edi is 1 on a page cross,
+// read_operand adds it once the access can't bail out any more.
+static void index_address(struct Emitter* e, uint8_t field, bool page_penalty){
+    load_field(e, ECX, field);
+    if (page_penalty)
+    {
+        mov_reg(e, EDI, ESI);
+        alu_imm(e, ALU_AND, EDI, 0xff);
+        alu_reg(e, ALU_ADD, EDI, ECX);
+        shift_imm(e, false, EDI, 8);
+    }
+    alu_reg(e, ALU_ADD, ESI, ECX);
+    alu_imm(e, ALU_AND, ESI, 0xffff);
+}
+
+// esi = 16 bit pointer stored in the zero page at ecx
+static void zero_page_pointer(struct Emitter* e){
+    load_ram(e, ESI, ECX);
+    step_byte(e, ECX, true);                                  // wraps in the zero page
+    load_ram(e, EAX, ECX);
+    shift_imm(e, true, EAX, 8);
+    alu_reg(e, ALU_OR, ESI, EAX);
+}
+
+// Leaves the effective address in esi and returns its region
+static enum region effective_address(struct Emitter* e, const struct Instruction* in){
+    switch (in -> mode)
+    {
+        case MODE_ZERO_PAGE:
+            mov_imm(e, ESI, in -> operand);
+            return REGION_RAM;
+        case MODE_ABSOLUTE:
+            mov_imm(e, ESI, in -> operand);
+            return static_region(in -> operand);
+        case MODE_ZERO_PAGE_X:
+        case MODE_ZERO_PAGE_Y:
+            load_field(e, ESI, in -> mode == MODE_ZERO_PAGE_X ? FIELD(X) : FIELD(Y));
+            alu_imm(e, ALU_ADD, ESI, in -> operand);
+            alu_imm(e, ALU_AND, ESI, 0xff);
+            return REGION_RAM;
+        case MODE_ABSOLUTE_X:
+        case MODE_ABSOLUTE_Y:
+            mov_imm(e, ESI, in -> operand);
+            index_address(e, in -> mode == MODE_ABSOLUTE_X ? FIELD(X) : FIELD(Y), in -> page_penalty);
+            break;
+        case MODE_INDEXED_INDIRECT_X:
+            load_field(e, ECX, FIELD(X));
+            alu_imm(e, ALU_ADD, ECX, in -> operand);
+            alu_imm(e, ALU_AND, ECX, 0xff);
+            zero_page_pointer(e);
+            break;
+        case MODE_INDIRECT_Y:
+            mov_imm(e, ECX, in -> operand);
+            zero_page_pointer(e);
+            index_address(e, FIELD(Y), in -> page_penalty);
+            break;
+        default:
+            break;
+    }
+    return REGION_UNKNOWN;
+}
+
+// Reads the operand into eax
+static void read_operand(struct Emitter* e, cpu c, const struct Instruction* in, uint16_t pc, int cycles){
+    if (in -> mode == MODE_IMMEDIATE)
+    {
+        mov_imm(e, EAX, in -> operand);
+        return;
+    }
+    // PRG-ROM can't change under the block, it is dropped on bank switches
+    if (in -> mode == MODE_ABSOLUTE && static_region(in -> operand) == REGION_ROM)
+    {
+        mov_imm(e, EAX, bus_read(c -> bus, in -> operand));
+        return;
+    }
+
+    enum region region = effective_address(e, in);
+    if (region == REGION_CARTRIDGE)
+    {
+        call_bus(e, (void*)bus_read);
+        emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, modrm(3, EAX, EAX)); // movzx eax, al
+        return;
+    }
+
+    size_t high = 0;
+    if (region == REGION_UNKNOWN)
+    {
+        cmp_imm(e, ESI, 0x2000);
+        high = jump_if(e, CC_AE);
+    }
+    mov_reg(e, ECX, ESI);
+    alu_imm(e, ALU_AND, ECX, 0x7ff);
+    load_ram(e, EAX, ECX);
+    if (in -> page_penalty) add_penalty(e, EDI);
+    if (region == REGION_UNKNOWN)
+    {
+        size_t done = jump(e);
+        patch(e, high);
+        cmp_imm(e, ESI, 0x4020);
+        bail_if(e, CC_B, pc, cycles);
+        if (in -> page_penalty) add_penalty(e, EDI);
+        call_bus(e, (void*)bus_read);
+        emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, modrm(3, EAX, EAX));
+        patch(e, done);
+    }
+}
+
+// Writes dl to the address in esi. RAM holding decoded code goes through bus_write,
+// so the interpreter drops it from the decode cache
+static void write_operand(struct Emitter* e, enum region region, uint16_t pc, int cycles){
+    size_t high = 0, call = 0, done = 0;
+    if (region == REGION_CARTRIDGE)
+    {
+        call_bus(e, (void*)bus_write);
+        return;
+    }
+    if (region == REGION_UNKNOWN)
+    {
+        cmp_imm(e, ESI, 0x2000);
+        high = jump_if(e, CC_AE);
+    }
+    mov_reg(e, ECX, ESI);
+    alu_imm(e, ALU_AND, ECX, 0x7ff);
+    test_code_mark(e, ECX);
+    call = jump_if(e, CC_NE);
+    store_ram(e, ECX, EDX);
+    done = jump(e);
+    if (region == REGION_UNKNOWN)
+    {
+        patch(e, high);
+        cmp_imm(e, ESI, 0x4020);
+        bail_if(e, CC_B, pc, cycles);
+        cmp_imm(e, ESI, 0x8000);
+        bail_if(e, CC_AE, pc, cycles);
+    }
+    patch(e, call);
+    call_bus(e, (void*)bus_write);
+    patch(e, done);
+}
+
+// eax = shifted eax, C from the bit shifted out
+static void shift_value(struct Emitter* e, enum Operation op){
+    bool left   = op == OP_ASL || op == OP_ROL;
+    bool rotate = op == OP_ROL || op == OP_ROR;
+    if (rotate) load_carry(e, ECX);
+    test_imm(e, EAX, left ? 0x80 : 0x01);
+    set_flag_cc(e, CC_NE, FLAG_C);
+    if (left)
+        alu_reg(e, ALU_ADD, EAX, EAX);
+    else
+        shift_imm(e, false, EAX, 1);
+    if (rotate)
+    {
+        if (!left) shift_imm(e, true, ECX, 7);
+        alu_reg(e, ALU_OR, EAX, ECX);
+    }
+    set_nz(e, EAX);
+}
+
+// A = A + eax + C, SBC adds the complement
+static void add_with_carry(struct Emitter* e, bool subtract){
+    if (subtract) alu_imm(e, ALU_XOR, EAX, 0xff);
+    load_field(e, ECX, FIELD(A));
+    load_carry(e, EDX);
+    alu_reg(e, ALU_ADD, EDX, ECX);
+    alu_reg(e, ALU_ADD, EDX, EAX);
+    test_imm(e, EDX, 0x100);
+    set_flag_cc(e, CC_NE, FLAG_C);
+    // Signed overflow: the sign of the sum differs from both operands
+    alu_reg(e, ALU_XOR, ECX, EDX);
+    alu_reg(e, ALU_XOR, EAX, EDX);
+    alu_reg(e, ALU_AND, EAX, ECX);
+    test_imm(e, EAX, 0x80);
+    set_flag_cc(e, CC_NE, FLAG_V);
+    store_field(e, FIELD(A), EDX);
+    set_nz(e, EDX);
+}
+
+static void register_op(struct Emitter* e, uint8_t from, uint8_t to, int delta, bool flags){
+    load_field(e, EAX, from);
+    if (delta > 0) alu_imm(e, ALU_ADD, EAX, 1);
+    if (delta < 0) alu_imm(e, ALU_SUB, EAX, 1);
+    store_field(e, to, EAX);
+    if (flags) set_nz(e, EAX);
+}
+
+// esi = stack address of a push (SP, then decremented) or a pull (SP incremented first)
+static void stack_address(struct Emitter* e, bool pull){
+    load_field(e, ECX, FIELD(SP));
+    if (pull) step_byte(e, ECX, true);
+    mov_reg(e, ESI, ECX);
+    alu_imm(e, ALU_OR, ESI, 0x100);
+    if (!pull) step_byte(e, ECX, false);
+    store_field(e, FIELD(SP), ECX);
+}
+
+static void push_value(struct Emitter* e, uint16_t pc, int cycles){
+    stack_address(e, false);
+    write_operand(e, REGION_RAM, pc, cycles);
+}
+
+static bool is_branch_back(const struct Instruction* in, uint16_t pc){
+    uint16_t next   = pc + in -> length;
+    uint16_t target = in -> mode == MODE_RELATIVE ? (uint16_t)(next + (int8_t)in -> operand) : in -> operand;
+    return target <= pc && pc - target <= IDLE_LOOP_MAX_LENGTH;
+}
+
+// Whether the instruction can be translated, looking at what is known before running it
+static bool translatable(const struct Instruction* in, uint16_t pc){
+    if (in -> op == OP_NONE) return false;
+    // Short loops stay interpreted so idle loop detection still sees them
+    if ((in -> mode == MODE_RELATIVE || in -> op == OP_JMP) && is_branch_back(in, pc)) return false;
+    if (in -> mode != MODE_ABSOLUTE || in -> op == OP_JMP || in -> op == OP_JSR) return true;
+
+    enum region region = static_region(in -> operand);
+    bool writes = in -> access == ACCESS_WRITE;
+    bool rmw    = in -> access == ACCESS_RMW;
+    if (region == REGION_IO) return false;
+    if (region == REGION_ROM && (writes || rmw)) return false;
+    if (region == REGION_CARTRIDGE && rmw) return false;
+    return true;
+}
+
+// Emits one instruction, cycles are the block cycles before it. Returns true if it ends the block.
+static bool translate_instruction(struct Emitter* e, cpu c, const struct Instruction* in, uint16_t pc, int cycles){
+    uint16_t next = pc + in -> length;
+
+    switch (in -> op)
+    {
+        case OP_LDA:
+        case OP_LDX:
+        case OP_LDY:
+            read_operand(e, c, in, pc, cycles);
+            store_field(e, in -> op == OP_LDA ? FIELD(A) : in -> op == OP_LDX ? FIELD(X) : FIELD(Y), EAX);
+            set_nz(e, EAX);
+            break;
+        case OP_STA:
+        case OP_STX:
+        case OP_STY:
+        {
+            enum region region = effective_address(e, in);
+            load_field(e, EDX, in -> op == OP_STA ? FIELD(A) : in -> op == OP_STX ? FIELD(X) : FIELD(Y));
+            write_operand(e, region, pc, cycles);
+            break;
+        }
+        case OP_ORA:
+        case OP_AND:
+        case OP_EOR:
+            read_operand(e, c, in, pc, cycles);
+            load_field(e, ECX, FIELD(A));
+            alu_reg(e, in -> op == OP_ORA ? ALU_OR : in -> op == OP_AND ? ALU_AND : ALU_XOR, EAX, ECX);
+            store_field(e, FIELD(A), EAX);
+            set_nz(e, EAX);
+            break;
+        case OP_ADC:
+        case OP_SBC:
+            read_operand(e, c, in, pc, cycles);
+            add_with_carry(e, in -> op == OP_SBC);
+            break;
+        case OP_CMP:
+        case OP_CPX:
+        case OP_CPY:
+            read_operand(e, c, in, pc, cycles);
+            load_field(e, ECX, in -> op == OP_CMP ? FIELD(A) : in -> op == OP_CPX ? FIELD(X) : FIELD(Y));
+            alu_reg(e, ALU_SUB, ECX, EAX);
+            set_flag_cc(e, CC_AE, FLAG_C);
+            set_nz(e, ECX);
+            break;
+        case OP_BIT:
+            read_operand(e, c, in, pc, cycles);
+            load_field(e, ECX, FIELD(A));
+            alu_reg(e, ALU_AND, ECX, EAX);
+            // N from the operand goes to bit 8 of nz, as in the interpreter
+            mov_reg(e, EDX, EAX);
+            alu_imm(e, ALU_AND, EDX, 0x80);
+            alu_reg(e, ALU_ADD, EDX, EDX);
+            alu_reg(e, ALU_OR, ECX, EDX);
+            emit8(e, 0x66); emit8(e, 0x89); emit8(e, modrm(1, ECX, EBX)); emit8(e, FIELD(nz)); // mov [rbx + nz], cx
+            test_imm(e, EAX, 0x40);
+            set_flag_cc(e, CC_NE, FLAG_V);
+            break;
+        case OP_ASL:
+        case OP_ROL:
+        case OP_LSR:
+        case OP_ROR:
+        case OP_INC:
+        case OP_DEC:
+        {
+            if (in -> mode == MODE_ACCUMULATOR)
+            {
+                load_field(e, EAX, FIELD(A));
+                shift_value(e, in -> op);
+                store_field(e, FIELD(A), EAX);
+                break;
+            }
+            // Read-modify-write only runs on RAM, anything else is left to the interpreter
+            enum region region = effective_address(e, in);
+            if (region == REGION_UNKNOWN)
+            {
+                cmp_imm(e, ESI, 0x2000);
+                bail_if(e, CC_AE, pc, cycles);
+            }
+            mov_reg(e, ECX, ESI);
+            alu_imm(e, ALU_AND, ECX, 0x7ff);
+            load_ram(e, EAX, ECX);
+            if (in -> op == OP_INC || in -> op == OP_DEC)
+            {
+                alu_imm(e, in -> op == OP_INC ? ALU_ADD : ALU_SUB, EAX, 1);
+                set_nz(e, EAX);
+            }
+            else
+                shift_value(e, in -> op);
+            mov_reg(e, EDX, EAX);
+            write_operand(e, REGION_RAM, pc, cycles);
+            break;
+        }
+        case OP_INX: register_op(e, FIELD(X), FIELD(X),  1, true); break;
+        case OP_INY: register_op(e, FIELD(Y), FIELD(Y),  1, true); break;
+        case OP_DEX: register_op(e, FIELD(X), FIELD(X), -1, true); break;
+        case OP_DEY: register_op(e, FIELD(Y), FIELD(Y), -1, true); break;
+        case OP_TAX: register_op(e, FIELD(A), FIELD(X),  0, true); break;
+        case OP_TAY: register_op(e, FIELD(A), FIELD(Y),  0, true); break;
+        case OP_TXA: register_op(e, FIELD(X), FIELD(A),  0, true); break;
+        case OP_TYA: register_op(e, FIELD(Y), FIELD(A),  0, true); break;
+        case OP_TSX: register_op(e, FIELD(SP), FIELD(X), 0, true); break;
+        case OP_TXS: register_op(e, FIELD(X), FIELD(SP), 0, false); break;
+        case OP_CLC: store_flag(e, FLAG_C, false); break;
+        case OP_SEC: store_flag(e, FLAG_C, true); break;
+        case OP_CLD: store_flag(e, FLAG_D, false); break;
+        case OP_SED: store_flag(e, FLAG_D, true); break;
+        case OP_CLV: store_flag(e, FLAG_V, false); break;
+        case OP_SEI: store_flag(e, FLAG_I, true); break;
+        case OP_NOP: break;
+        case OP_CLI:
+            // A pending IRQ must be taken right after it, on the next boundary
+            store_flag(e, FLAG_I, false);
+            store_pc_imm(e, next);
+            return true;
+        case OP_PHA:
+            load_field(e, EDX, FIELD(A));
+            push_value(e, pc, cycles);
+            break;
+        case OP_PLA:
+            stack_address(e, true);
+            load_ram(e, EAX, ESI);
+            store_field(e, FIELD(A), EAX);
+            set_nz(e, EAX);
+            break;
+        case OP_JSR:
+            // The pushed return address is the last byte of the JSR instruction
+            mov_imm(e, EDX, (uint16_t)(next - 1) >> 8);
+            push_value(e, pc, cycles);
+            mov_imm(e, EDX, (uint8_t)(next - 1));
+            push_value(e, pc, cycles);
+            store_pc_imm(e, in -> operand);
+            return true;
+        case OP_RTS:
+            stack_address(e, true);
+            load_ram(e, EAX, ESI);
+            stack_address(e, true);
+            load_ram(e, EDX, ESI);
+            shift_imm(e, true, EDX, 8);
+            alu_reg(e, ALU_OR, EAX, EDX);
+            alu_imm(e, ALU_ADD, EAX, 1);
+            emit8(e, 0x66); emit8(e, 0x89); emit8(e, modrm(1, EAX, EBX)); emit8(e, FIELD(PC)); // mov [rbx + PC], ax
+            return true;
+        case OP_JMP:
+            store_pc_imm(e, in -> operand);
+            return true;
+        case OP_BPL: case OP_BMI: case OP_BVC: case OP_BVS:
+        case OP_BCC: case OP_BCS: case OP_BNE: case OP_BEQ:
+        {
+            uint16_t target = next + (int8_t)in -> operand;
+            bool     on_set = in -> opcode & BRANCH_COND_MASK;
+            int      flag   = in -> opcode >> BRANCH_ON_FLAG_SHIFT;
+            store_pc_imm(e, next);
+            if (flag == Negative)
+            {
+                // test word [rbx + nz], 0x180
+                emit8(e, 0x66); emit8(e, 0xf7); emit8(e, modrm(1, 0, EBX)); emit8(e, FIELD(nz)); emit8(e, 0x80); emit8(e, 0x01);
+            }
+            else if (flag == Zero)
+            {
+                // test byte [rbx + nz], 0xff, inverted: the host ZF is the 6502 Z
+                emit8(e, 0xf6); emit8(e, modrm(1, 0, EBX)); emit8(e, FIELD(nz)); emit8(e, 0xff);
+                on_set = !on_set;
+            }
+            else
+                test_flag(e, flag == Overflow ? FLAG_V : FLAG_C);
+            size_t skip = jump_if(e, on_set ? CC_E : CC_NE);
+            store_pc_imm(e, target);
+            add_penalty_imm(e, 1 + ((next & 0xff00) != (target & 0xff00)));
+            patch(e, skip);
+            return true;
+        }
+        default:
+            break;
+    }
+    return false;
+}
+
+// Blocks
+
+static void flush(dynarec d){
+    d -> used = 0;
+    memset(d -> blocks, 0, sizeof(d -> blocks));
+    ++d -> flushes;
+}
+
+// Translates from start up to the first instruction that has to be interpreted,
+// a jump or branch, or DYNAREC_MAX_BLOCK_LENGTH instructions
+static void translate(dynarec d, cpu c, uint16_t start, struct DynarecBlock* block){
+    if (DYNAREC_BUFFER_SIZE - d -> used < DYNAREC_MAX_BLOCK_BYTES) flush(d);
+
+    struct Emitter e;
+    e.code       = d -> buffer + d -> used;
+    e.size       = 0;
+    e.bails_size = 0;
+
+    uint16_t pc         = start;
+    int      cycles     = 0;
+    int      max_cycles = 0;
+    int      length     = 0;
+    bool     ended      = false;
+
+    prologue(&e);
+    while (!ended && length < DYNAREC_MAX_BLOCK_LENGTH && pc >= 0x8000)
+    {
+        struct Instruction in;
+        decode_instruction(bus_read(c -> bus, pc), &in);
+        // Code running out of PRG-ROM is left to the interpreter
+        if (pc + in.length > 0x10000) break;
+        in.operand = 0;
+        if (in.length > 1) in.operand  = bus_read(c -> bus, pc + 1);
+        if (in.length > 2) in.operand |= bus_read(c -> bus, pc + 2) << 8;
+        if (!translatable(&in, pc)) break;
+
+        ended       = translate_instruction(&e, c, &in, pc, cycles);
+        cycles     += in.cycles;
+        max_cycles += in.cycles + in.page_penalty + (in.mode == MODE_RELATIVE ? 2 : 0);
+        pc         += in.length;
+        ++length;
+    }
+
+    block -> tag    = c -> bus -> mapper -> prg_generation;
+    block -> length = length;
+    if (!length)
+    {
+        block -> code       = NULL;
+        block -> max_cycles = 0;
+        return;
+    }
+
+    if (!ended) store_pc_imm(&e, pc);
+    epilogue(&e, cycles);
+    for (int i = 0; i < e.bails_size; ++i)
+    {
+        patch(&e, e.bails[i].patch);
+        store_pc_imm(&e, e.bails[i].pc);
+        epilogue(&e, e.bails[i].cycles);
+    }
+
+    block -> code       = (block_code)(d -> buffer + d -> used);
+    block -> max_cycles = max_cycles;
+    d -> used          += (e.size + 15) & ~(size_t)15;
+    ++d -> translated;
+}
+
+#ifdef DYNAREC_DIFF
+
+// Runs the block, then the interpreter over the same cycles from the same state, and compares.
+// The interpreter result is kept, so a bad block can't derail the rest of the run.
+// nz is compared through the flags it stands for
+static bool same_registers(registers a, registers b){
+    return a -> PC == b -> PC && a -> SP == b -> SP && a -> A == b -> A && a -> X == b -> X && a -> Y == b -> Y &&
+           get_P(a) == get_P(b);
+}
+
+static int run_checked(dynarec d, cpu c, registers r, struct DynarecBlock* block){
+    static uint8_t   ram[0x800], ext_ram[0x2000], translated_ram[0x800], translated_ext_ram[0x2000];
+    bus              b     = c -> bus;
+    struct Registers start = *r;
+
+    memcpy(ram, b -> RAM, sizeof(ram));
+    if (b -> extRAM) memcpy(ext_ram, b -> extRAM, sizeof(ext_ram));
+
+    int ran = block -> code(r, b -> RAM, b);
+    if (!ran) return 0;
+
+    struct Registers translated = *r;
+    memcpy(translated_ram, b -> RAM, sizeof(ram));
+    if (b -> extRAM) memcpy(translated_ext_ram, b -> extRAM, sizeof(ext_ram));
+
+    *r = start;
+    memcpy(b -> RAM, ram, sizeof(ram));
+    if (b -> extRAM) memcpy(b -> extRAM, ext_ram, sizeof(ext_ram));
+
+    // A wrong branch in the block can send the interpreter somewhere else, stop on illegal opcodes
+    int interpreted = 0, cycles = 1;
+    while (interpreted < ran && cycles) interpreted += cycles = cpu_interpret(c, r);
+
+    bool same_memory = !memcmp(translated_ram, b -> RAM, sizeof(ram)) &&
+                       (!b -> extRAM || !memcmp(translated_ext_ram, b -> extRAM, sizeof(ext_ram)));
+    if (interpreted != ran || !same_registers(&translated, r) || !same_memory)
+    {
+        ++d -> mismatches;
+        perror("Dynarec mismatch in block $%04X: %d cycles, PC:%04X A:%02X X:%02X Y:%02X SP:%02X P:%02X%s, "
+               "interpreter %d cycles, PC:%04X A:%02X X:%02X Y:%02X SP:%02X P:%02X",
+               start.PC, ran, translated.PC, translated.A, translated.X, translated.Y, translated.SP,
+               get_P(&translated),
+               same_memory ? "" : ", memory differs",
+               interpreted, r -> PC, r -> A, r -> X, r -> Y, r -> SP, get_P(r));
+    }
+    return interpreted;
+}
+
+#endif
+
+// Public
+
+dynarec dynarec_create(void){
+    dynarec d = calloc(1, sizeof(struct Dynarec));
+    if (!d) exit(EXIT_FAILURE);
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_JIT
+    flags |= MAP_JIT;
+#endif
+    d -> buffer = mmap(NULL, DYNAREC_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+    if (d -> buffer == MAP_FAILED) {
+        perror("Dynarec: can't map the code buffer");
+        exit(EXIT_FAILURE);
+    }
+    return d;
+}
+
+int dynarec_execute(dynarec d, cpu c, registers r, int64_t budget){
+    if (r -> PC < 0x8000) return 0;
+
+    struct DynarecBlock* block = &d -> blocks[r -> PC - 0x8000];
+    if (block -> tag != c -> bus -> mapper -> prg_generation) translate(d, c, r -> PC, block);
+    if (!block -> code || block -> max_cycles > budget) return 0;
+
+    ++d -> runs;
+#ifdef DYNAREC_DIFF
+    return run_checked(d, c, r, block);
+#else
+    return block -> code(r, c -> bus -> RAM, c -> bus);
+#endif
+}
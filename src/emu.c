@@ -6,6 +6,9 @@
 
 // emulator.c
 #include "headers/apu/constants.h"
+#ifdef CPU_DYNAREC
+#include "headers/dynarec.h"
+#endif
 
 
 #ifdef LOG_DEBUG
@@ -35,7 +38,9 @@ static inline TimePointNS now_ns(void) {
 
 
 void pb_flush_to_gpu(p_buffer pb) {
-    // Copia tutto il framebuffer (RGBA8) nella texture sulla GPU
+    // La PPU scrive solo gli indici dei colori NES: la conversione in RGBA8 si fa qui,
+    // una volta per frame presentato, poi si copia tutto nella texture sulla GPU
+    PBResolve(pb);
     UpdateTexture(pb->tex, pb->pixels);
 }
 
@@ -43,7 +48,7 @@ void pb_flush_to_gpu(p_buffer pb) {
 void emulator_init(Emulator *e){
     e -> cpu = (cpu)malloc(sizeof(struct CPU));
     e -> apu = (apu)malloc(sizeof(struct APU));
-    e -> ppu = (ppu)malloc(sizeof(struct PPU));
+    e -> ppu = (ppu)aligned_alloc(_Alignof(struct PPU), sizeof(struct PPU));
     e -> picture_bus = (pbus)malloc(sizeof(struct picture_bus));
     e -> cartridge = (cartridge)malloc(sizeof(struct Cartridge));
     e -> controller_set = (cs)malloc(sizeof(struct controller_set));
@@ -51,11 +56,16 @@ void emulator_init(Emulator *e){
     e -> audio_player = (audio_player)malloc(sizeof(struct AudioPlayer));
 
     pbus_init(e -> picture_bus);
+    bus_init(e -> bus, e -> ppu, e -> apu, e -> controller_set, doDMA);
+    cpu_init(e -> cpu, e -> bus);
+    e -> debugger = debugger_create(e -> cpu);
     create_ppu(e -> ppu, e -> picture_bus);
     controllerset_init(e -> controller_set);
     init_audio(e -> audio_player, 1.0 / APU_CLOCK_PERIOD_S);
     apu_init(e -> apu, e -> audio_player, create_IRQ_handler(e -> cpu), emulator_dmcdma);
-    bus_init(e -> bus, e -> ppu, e -> apu, e -> controller_set, doDMA);
+    ppu_map_registers(e -> ppu, e -> bus);
+    apu_map_registers(e -> apu, e -> bus);
+    controller_map_registers(e -> controller_set, e -> bus);
 
     /* Audio/video */
     audio_player     audio_player;
@@ -91,8 +101,7 @@ void emulator_run(Emulator *e, const char *rom_path)
     if (!e->cartridge) return;
 
     // Mapper (unique_ptr in C++ ⇒ puntatore in C)
-    create_mapper(e -> mapper, e->cartridge,
-                              create_IRQ_handler(e->cpu));
+    e->mapper = create_mapper(e->cartridge, create_IRQ_handler(e->cpu));
     if (!e->mapper) {
         perror("Creating Mapper failed. Probably unsupported.");
         return;
@@ -101,10 +110,14 @@ void emulator_run(Emulator *e, const char *rom_path)
     if (!setMapper(e->bus, e->mapper) || !set_mapper(e->picture_bus, e->mapper)) {
         return;
     }
+    cpu_use_mapper(e->cpu, e->mapper);
 
     cpu_reset(e->cpu);
     reset(e->ppu);
 
+    // PPU e APU sono pronti per il primo ciclo CPU
+    emulator_start_timing(e);
+
     // schermo virtuale (se hai un wrapper tuo; altrimenti usa direttamente pb_* + raylib)
     // virtual_screen_create(...);  // opzionale
 
@@ -135,6 +148,7 @@ void emulator_run(Emulator *e, const char *rom_path)
         if (IsKeyPressed(KEY_F2)) {
             pause = !pause;
             if (!pause) {
+                debugger_resume(e->debugger);
                 TimePointNS now = now_ns();
                 printf("Unpaused. Removing %llu ns from timers",
                           (unsigned long long)(now - e->last_wakeup_ns));
@@ -146,16 +160,10 @@ void emulator_run(Emulator *e, const char *rom_path)
 
         // single-step ~1 frame con F3 (solo se in pausa)
         if (pause && IsKeyReleased(KEY_F3)) {
-            for (int i = 0; i < 29781; ++i) {
-                // PPU
-                step(e->ppu, e->cpu);
-                step(e->ppu, e->cpu);
-                step(e->ppu, e->cpu);
-                // CPU
-                cpu_step(e->cpu);
-                // APU
-                apu_step(e->apu);
-            }
+            debugger_resume(e->debugger);
+            for (int64_t done = 0; done < 29781 && !debugger_hit(e->debugger); )
+                done += emulator_run_slice(e, 29781 - done);
+            if (debugger_hit(e->debugger)) debugger_dump(e->debugger);
         }
 
         // set log level con F4/F5 (opzionale)
@@ -167,17 +175,17 @@ void emulator_run(Emulator *e, const char *rom_path)
             e->elapsed_ns += (now - e->last_wakeup_ns);
             e->last_wakeup_ns = now;
 
-            while (e->elapsed_ns > CPU_CLOCK_PERIOD_NS) {
-                // PPU 3x per CPU 1x
-                step(e->ppu, e->cpu);
-                step(e->ppu, e->cpu);
-                step(e->ppu, e->cpu);
-                // CPU
-                cpu_step(e->cpu);
-                // APU
-                apu_step(e->apu);
-
-                e->elapsed_ns -= CPU_CLOCK_PERIOD_NS;
+            // la CPU gira a blocchi, PPU e APU la raggiungono quando serve
+            while (e->elapsed_ns > CPU_CLOCK_PERIOD_NS && !debugger_hit(e->debugger)) {
+                int64_t budget = (int64_t)((e->elapsed_ns - 1) / CPU_CLOCK_PERIOD_NS);
+                e->elapsed_ns -= (DurationNS)emulator_run_slice(e, budget) * CPU_CLOCK_PERIOD_NS;
+            }
+
+            // watchpoint o breakpoint: dump e pausa, F2 riparte
+            if (debugger_hit(e->debugger)) {
+                debugger_dump(e->debugger);
+                pause = true;
+                printf("Paused.");
             }
 
             // flush video → GPU e disegna
@@ -197,6 +205,27 @@ void emulator_run(Emulator *e, const char *rom_path)
             WaitTime(1.0/60.0);
         }
     }
+
+    // quanto tempo CPU hanno fatto risparmiare i polling loop saltati
+    if (e->cpu->cycles > 0)
+        printf("Idle loops skipped %lld of %lld CPU cycles (%.1f%%)",
+               (long long)e->cpu->idle_skipped_cycles, (long long)e->cpu->cycles,
+               100.0 * (double)e->cpu->idle_skipped_cycles / (double)e->cpu->cycles);
+
+    // superistruzioni: quante volte sono scattate in questo gioco e quanto tempo CPU coprono
+    for (int f = FUSION_NONE + 1; f < FUSION_COUNT && e->cpu->cycles > 0; ++f)
+        printf("Superinstruction %s in %s: %lld runs, %.2f%% of CPU cycles",
+               cpu_fusion_name(f), rom_path, (long long)e->cpu->fusion_runs[f],
+               100.0 * (double)e->cpu->fusion_cycles[f] / (double)e->cpu->cycles);
+
+#ifdef CPU_DYNAREC
+    printf("Dynarec: %lld blocks translated, %lld block runs, %lld buffer flushes",
+           (long long)e->cpu->dynarec->translated, (long long)e->cpu->dynarec->runs,
+           (long long)e->cpu->dynarec->flushes);
+#ifdef DYNAREC_DIFF
+    printf("Dynarec: %lld blocks differed from the interpreter", (long long)e->cpu->dynarec->mismatches);
+#endif
+#endif
 }
 
 /* DMA OAM (PPU) */
@@ -0,0 +1,102 @@
+#include "headers/emu.h"
+
+// Sincronizzazione: la CPU gira a slice con cpu_run, PPU e APU la raggiungono quando serve
+
+/* Porta PPU e APU al ciclo CPU k: nel loop per ciclo la PPU fa i suoi 3 step
+ * prima della CPU e l'APU il suo dopo, quindi PPU a 3k dot e APU a k-1 step.
+ * Nessuna scrittura ai registri cade dentro un catch up, quindi le scanline intere
+ * vengono disegnate in un colpo e solo quelle spezzate da un sync vanno dot per dot */
+static void emulator_catch_up(Emulator *e, int64_t k)
+{
+    if (e->ppu_cycles < k) {
+        ppu_run(e->ppu, e->cpu, 3 * (k - e->ppu_cycles));
+        e->ppu_cycles = k;
+    }
+    while (e->apu_cycles < k - 1) {
+        apu_step(e->apu);
+        ++e->apu_cycles;
+    }
+}
+
+/* IRQ dei mapper con contatore di scanline (MMC3): il contatore viene aggiornato qui,
+ * con i clock contati dalla PPU, e l'evento messo al ciclo del clock che lo fa scattare.
+ * Il ciclo resta anche in mapper_irq_cycle, perché cpu_run disarma l'evento quando lo raggiunge */
+static void emulator_schedule_mapper_irq(Emulator *e)
+{
+    cpu c = e->cpu;
+    e->mapper_irq_cycle = CPU_NO_EVENT;
+    if (!e->mapper || !e->mapper->irq_clocks) return;
+
+    int clocks = e->mapper->irq_clocks(e->mapper, e->ppu->line_clocks);
+    int dots   = clocks ? ppu_dots_until_line_clock(e->ppu, clocks) : -1;
+    if (dots > 0) {
+        e->mapper_irq_cycle = e->ppu_cycles + (dots + 2) / 3;
+        cpu_schedule_event(c, e->mapper_irq_event, e->mapper_irq_cycle);
+    } else {
+        cpu_cancel_event(c, e->mapper_irq_event);
+    }
+}
+
+/* Chiamata dopo le scritture a PPUMASK e ai registri IRQ del mapper, a PPU già allineata:
+ * sono le sole che cambiano la previsione, quindi il sync non la rifà */
+static void emulator_irq_timing_changed(void *owner)
+{
+    emulator_schedule_mapper_irq((Emulator *)owner);
+}
+
+/* Eventi a cui cpu_run deve fermarsi: vblank, IRQ del frame counter e fetch del DMC,
+ * così gli interrupt arrivano allo stesso ciclo del loop per ciclo e i polling loop
+ * vengono saltati solo fino al prossimo di questi */
+static void emulator_schedule_events(Emulator *e)
+{
+    cpu c = e->cpu;
+
+    int dots = ppu_dots_until_vblank(e->ppu);
+    cpu_schedule_event(c, e->vblank_event, e->ppu_cycles + (dots + 2) / 3);
+
+    int apu_steps = apu_steps_until_frame_irq(e->apu);
+    if (apu_steps > 0) cpu_schedule_event(c, e->frame_irq_event, e->apu_cycles + apu_steps + 1);
+    else               cpu_cancel_event(c, e->frame_irq_event);
+
+    apu_steps = apu_steps_until_dmc_fetch(e->apu);
+    if (apu_steps > 0) cpu_schedule_event(c, e->dmc_event, e->apu_cycles + apu_steps + 1);
+    else               cpu_cancel_event(c, e->dmc_event);
+}
+
+/* Chiamata dal bus prima di un accesso che PPU/APU possono osservare; le previsioni
+ * vengono rifatte perché le scritture precedenti possono averle cambiate. Quella
+ * dell'IRQ del mapper no: la rifà emulator_irq_timing_changed quando serve */
+static void emulator_sync(void *owner)
+{
+    Emulator *e = (Emulator *)owner;
+    emulator_catch_up(e, e->cpu->cycles);
+    emulator_schedule_events(e);
+}
+
+/* Dopo i reset: aggancia il sync a bus, PPU e mapper e porta PPU e APU al primo ciclo CPU */
+void emulator_start_timing(Emulator *e)
+{
+    set_sync_callback(e->bus, emulator_sync, e);
+    set_rendering_callback(e->ppu, emulator_irq_timing_changed, e);
+    if (e->mapper) set_irq_callback(e->mapper, emulator_irq_timing_changed, e, &e->ppu->line_clocks);
+
+    e->vblank_event     = cpu_register_event(e->cpu);
+    e->frame_irq_event  = cpu_register_event(e->cpu);
+    e->dmc_event        = cpu_register_event(e->cpu);
+    e->mapper_irq_event = cpu_register_event(e->cpu);
+    e->mapper_irq_cycle = CPU_NO_EVENT;
+    e->ppu_cycles       = e->apu_cycles = 0;
+    emulator_catch_up(e, e->cpu->cycles + 1);
+}
+
+/* Esegue la CPU per al più budget cicli e riallinea PPU e APU; restituisce i cicli eseguiti */
+int64_t emulator_run_slice(Emulator *e, int64_t budget)
+{
+    emulator_schedule_events(e);
+    /* La slice precedente si è fermata sul clock dell'IRQ del mapper: il contatore lo fa
+     * partire e l'evento passa all'IRQ dopo */
+    if (e->ppu_cycles >= e->mapper_irq_cycle) emulator_schedule_mapper_irq(e);
+    int64_t ran = cpu_run(e->cpu, budget);
+    emulator_catch_up(e, e->cpu->cycles + 1);
+    return ran;
+}
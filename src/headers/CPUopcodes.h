@@ -5,104 +5,222 @@
 #ifndef EASYNES_CPUOPCODES_H
 #define EASYNES_CPUOPCODES_H
 
-enum branch_on_flag
-{
-    Negative,
-    Overflow,
-    Carry,
-    Zero
-};
-
-enum operation_1
-{
-    ORA,
-    AND,
-    EOR,
-    ADC,
-    STA,
-    LDA,
-    CMP,
-    SBC,
+// Opcode specification. cpu.c generates a handler per opcode, the dispatch table (cycles
+// included) and the disassembler from it, the dynarec decodes with the same table.
+
+// X(mode, instruction length, operand format)
+#define CPU_ADDRESSING_MODES(X)                         \
+    X(IMPLIED,            1, "")                        \
+    X(ACCUMULATOR,        1, " A")                      \
+    X(IMMEDIATE,          2, " #$%02X")                 \
+    X(ZERO_PAGE,          2, " $%02X")                  \
+    X(ZERO_PAGE_X,        2, " $%02X,X")                \
+    X(ZERO_PAGE_Y,        2, " $%02X,Y")                \
+    X(ABSOLUTE,           3, " $%04X")                  \
+    X(ABSOLUTE_X,         3, " $%04X,X")                \
+    X(ABSOLUTE_Y,         3, " $%04X,Y")                \
+    X(INDEXED_INDIRECT_X, 2, " ($%02X,X)")              \
+    X(INDIRECT_Y,         2, " ($%02X),Y")              \
+    X(INDIRECT,           3, " ($%04X)")                \
+    X(RELATIVE,           2, " $%04X") // branch target
+
+#define CPU_OPERATIONS(X)                                                                   \
+    X(ADC) X(AND) X(ASL) X(BCC) X(BCS) X(BEQ) X(BIT) X(BMI) X(BNE) X(BPL) X(BRK) X(BVC) \
+    X(BVS) X(CLC) X(CLD) X(CLI) X(CLV) X(CMP) X(CPX) X(CPY) X(DEC) X(DEX) X(DEY) X(EOR) \
+    X(INC) X(INX) X(INY) X(JMP) X(JSR) X(LDA) X(LDX) X(LDY) X(LSR) X(NOP) X(ORA) X(PHA) \
+    X(PHP) X(PLA) X(PLP) X(ROL) X(ROR) X(RTI) X(RTS) X(SBC) X(SEC) X(SED) X(SEI) X(STA) \
+    X(STX) X(STY) X(TAX) X(TAY) X(TSX) X(TXA) X(TXS) X(TYA)
+
+// Official opcodes, the others are illegal.
+// X(opcode, operation, mode, base cycles, page cross penalty, memory access)
+// Stores and read-modify-write instructions always take the indexing cycle, so it is in the base count.
+#define CPU_OPCODES(X)                                  \
+    X(0x00, BRK, IMPLIED,            7, false, NONE)    \
+    X(0x01, ORA, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0x05, ORA, ZERO_PAGE,          3, false, READ)    \
+    X(0x06, ASL, ZERO_PAGE,          5, false, RMW)     \
+    X(0x08, PHP, IMPLIED,            3, false, NONE)    \
+    X(0x09, ORA, IMMEDIATE,          2, false, READ)    \
+    X(0x0A, ASL, ACCUMULATOR,        2, false, NONE)    \
+    X(0x0D, ORA, ABSOLUTE,           4, false, READ)    \
+    X(0x0E, ASL, ABSOLUTE,           6, false, RMW)     \
+    X(0x10, BPL, RELATIVE,           2, false, NONE)    \
+    X(0x11, ORA, INDIRECT_Y,         5, true,  READ)    \
+    X(0x15, ORA, ZERO_PAGE_X,        4, false, READ)    \
+    X(0x16, ASL, ZERO_PAGE_X,        6, false, RMW)     \
+    X(0x18, CLC, IMPLIED,            2, false, NONE)    \
+    X(0x19, ORA, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0x1D, ORA, ABSOLUTE_X,         4, true,  READ)    \
+    X(0x1E, ASL, ABSOLUTE_X,         7, false, RMW)     \
+    X(0x20, JSR, ABSOLUTE,           6, false, NONE)    \
+    X(0x21, AND, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0x24, BIT, ZERO_PAGE,          3, false, READ)    \
+    X(0x25, AND, ZERO_PAGE,          3, false, READ)    \
+    X(0x26, ROL, ZERO_PAGE,          5, false, RMW)     \
+    X(0x28, PLP, IMPLIED,            4, false, NONE)    \
+    X(0x29, AND, IMMEDIATE,          2, false, READ)    \
+    X(0x2A, ROL, ACCUMULATOR,        2, false, NONE)    \
+    X(0x2C, BIT, ABSOLUTE,           4, false, READ)    \
+    X(0x2D, AND, ABSOLUTE,           4, false, READ)    \
+    X(0x2E, ROL, ABSOLUTE,           6, false, RMW)     \
+    X(0x30, BMI, RELATIVE,           2, false, NONE)    \
+    X(0x31, AND, INDIRECT_Y,         5, true,  READ)    \
+    X(0x35, AND, ZERO_PAGE_X,        4, false, READ)    \
+    X(0x36, ROL, ZERO_PAGE_X,        6, false, RMW)     \
+    X(0x38, SEC, IMPLIED,            2, false, NONE)    \
+    X(0x39, AND, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0x3D, AND, ABSOLUTE_X,         4, true,  READ)    \
+    X(0x3E, ROL, ABSOLUTE_X,         7, false, RMW)     \
+    X(0x40, RTI, IMPLIED,            6, false, NONE)    \
+    X(0x41, EOR, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0x45, EOR, ZERO_PAGE,          3, false, READ)    \
+    X(0x46, LSR, ZERO_PAGE,          5, false, RMW)     \
+    X(0x48, PHA, IMPLIED,            3, false, NONE)    \
+    X(0x49, EOR, IMMEDIATE,          2, false, READ)    \
+    X(0x4A, LSR, ACCUMULATOR,        2, false, NONE)    \
+    X(0x4C, JMP, ABSOLUTE,           3, false, NONE)    \
+    X(0x4D, EOR, ABSOLUTE,           4, false, READ)    \
+    X(0x4E, LSR, ABSOLUTE,           6, false, RMW)     \
+    X(0x50, BVC, RELATIVE,           2, false, NONE)    \
+    X(0x51, EOR, INDIRECT_Y,         5, true,  READ)    \
+    X(0x55, EOR, ZERO_PAGE_X,        4, false, READ)    \
+    X(0x56, LSR, ZERO_PAGE_X,        6, false, RMW)     \
+    X(0x58, CLI, IMPLIED,            2, false, NONE)    \
+    X(0x59, EOR, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0x5D, EOR, ABSOLUTE_X,         4, true,  READ)    \
+    X(0x5E, LSR, ABSOLUTE_X,         7, false, RMW)     \
+    X(0x60, RTS, IMPLIED,            6, false, NONE)    \
+    X(0x61, ADC, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0x65, ADC, ZERO_PAGE,          3, false, READ)    \
+    X(0x66, ROR, ZERO_PAGE,          5, false, RMW)     \
+    X(0x68, PLA, IMPLIED,            4, false, NONE)    \
+    X(0x69, ADC, IMMEDIATE,          2, false, READ)    \
+    X(0x6A, ROR, ACCUMULATOR,        2, false, NONE)    \
+    X(0x6C, JMP, INDIRECT,           5, false, NONE)    \
+    X(0x6D, ADC, ABSOLUTE,           4, false, READ)    \
+    X(0x6E, ROR, ABSOLUTE,           6, false, RMW)     \
+    X(0x70, BVS, RELATIVE,           2, false, NONE)    \
+    X(0x71, ADC, INDIRECT_Y,         5, true,  READ)    \
+    X(0x75, ADC, ZERO_PAGE_X,        4, false, READ)    \
+    X(0x76, ROR, ZERO_PAGE_X,        6, false, RMW)     \
+    X(0x78, SEI, IMPLIED,            2, false, NONE)    \
+    X(0x79, ADC, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0x7D, ADC, ABSOLUTE_X,         4, true,  READ)    \
+    X(0x7E, ROR, ABSOLUTE_X,         7, false, RMW)     \
+    X(0x81, STA, INDEXED_INDIRECT_X, 6, false, WRITE)   \
+    X(0x84, STY, ZERO_PAGE,          3, false, WRITE)   \
+    X(0x85, STA, ZERO_PAGE,          3, false, WRITE)   \
+    X(0x86, STX, ZERO_PAGE,          3, false, WRITE)   \
+    X(0x88, DEY, IMPLIED,            2, false, NONE)    \
+    X(0x8A, TXA, IMPLIED,            2, false, NONE)    \
+    X(0x8C, STY, ABSOLUTE,           4, false, WRITE)   \
+    X(0x8D, STA, ABSOLUTE,           4, false, WRITE)   \
+    X(0x8E, STX, ABSOLUTE,           4, false, WRITE)   \
+    X(0x90, BCC, RELATIVE,           2, false, NONE)    \
+    X(0x91, STA, INDIRECT_Y,         6, false, WRITE)   \
+    X(0x94, STY, ZERO_PAGE_X,        4, false, WRITE)   \
+    X(0x95, STA, ZERO_PAGE_X,        4, false, WRITE)   \
+    X(0x96, STX, ZERO_PAGE_Y,        4, false, WRITE)   \
+    X(0x98, TYA, IMPLIED,            2, false, NONE)    \
+    X(0x99, STA, ABSOLUTE_Y,         5, false, WRITE)   \
+    X(0x9A, TXS, IMPLIED,            2, false, NONE)    \
+    X(0x9D, STA, ABSOLUTE_X,         5, false, WRITE)   \
+    X(0xA0, LDY, IMMEDIATE,          2, false, READ)    \
+    X(0xA1, LDA, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0xA2, LDX, IMMEDIATE,          2, false, READ)    \
+    X(0xA4, LDY, ZERO_PAGE,          3, false, READ)    \
+    X(0xA5, LDA, ZERO_PAGE,          3, false, READ)    \
+    X(0xA6, LDX, ZERO_PAGE,          3, false, READ)    \
+    X(0xA8, TAY, IMPLIED,            2, false, NONE)    \
+    X(0xA9, LDA, IMMEDIATE,          2, false, READ)    \
+    X(0xAA, TAX, IMPLIED,            2, false, NONE)    \
+    X(0xAC, LDY, ABSOLUTE,           4, false, READ)    \
+    X(0xAD, LDA, ABSOLUTE,           4, false, READ)    \
+    X(0xAE, LDX, ABSOLUTE,           4, false, READ)    \
+    X(0xB0, BCS, RELATIVE,           2, false, NONE)    \
+    X(0xB1, LDA, INDIRECT_Y,         5, true,  READ)    \
+    X(0xB4, LDY, ZERO_PAGE_X,        4, false, READ)    \
+    X(0xB5, LDA, ZERO_PAGE_X,        4, false, READ)    \
+    X(0xB6, LDX, ZERO_PAGE_Y,        4, false, READ)    \
+    X(0xB8, CLV, IMPLIED,            2, false, NONE)    \
+    X(0xB9, LDA, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0xBA, TSX, IMPLIED,            2, false, NONE)    \
+    X(0xBC, LDY, ABSOLUTE_X,         4, true,  READ)    \
+    X(0xBD, LDA, ABSOLUTE_X,         4, true,  READ)    \
+    X(0xBE, LDX, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0xC0, CPY, IMMEDIATE,          2, false, READ)    \
+    X(0xC1, CMP, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0xC4, CPY, ZERO_PAGE,          3, false, READ)    \
+    X(0xC5, CMP, ZERO_PAGE,          3, false, READ)    \
+    X(0xC6, DEC, ZERO_PAGE,          5, false, RMW)     \
+    X(0xC8, INY, IMPLIED,            2, false, NONE)    \
+    X(0xC9, CMP, IMMEDIATE,          2, false, READ)    \
+    X(0xCA, DEX, IMPLIED,            2, false, NONE)    \
+    X(0xCC, CPY, ABSOLUTE,           4, false, READ)    \
+    X(0xCD, CMP, ABSOLUTE,           4, false, READ)    \
+    X(0xCE, DEC, ABSOLUTE,           6, false, RMW)     \
+    X(0xD0, BNE, RELATIVE,           2, false, NONE)    \
+    X(0xD1, CMP, INDIRECT_Y,         5, true,  READ)    \
+    X(0xD5, CMP, ZERO_PAGE_X,        4, false, READ)    \
+    X(0xD6, DEC, ZERO_PAGE_X,        6, false, RMW)     \
+    X(0xD8, CLD, IMPLIED,            2, false, NONE)    \
+    X(0xD9, CMP, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0xDD, CMP, ABSOLUTE_X,         4, true,  READ)    \
+    X(0xDE, DEC, ABSOLUTE_X,         7, false, RMW)     \
+    X(0xE0, CPX, IMMEDIATE,          2, false, READ)    \
+    X(0xE1, SBC, INDEXED_INDIRECT_X, 6, false, READ)    \
+    X(0xE4, CPX, ZERO_PAGE,          3, false, READ)    \
+    X(0xE5, SBC, ZERO_PAGE,          3, false, READ)    \
+    X(0xE6, INC, ZERO_PAGE,          5, false, RMW)     \
+    X(0xE8, INX, IMPLIED,            2, false, NONE)    \
+    X(0xE9, SBC, IMMEDIATE,          2, false, READ)    \
+    X(0xEA, NOP, IMPLIED,            2, false, NONE)    \
+    X(0xEC, CPX, ABSOLUTE,           4, false, READ)    \
+    X(0xED, SBC, ABSOLUTE,           4, false, READ)    \
+    X(0xEE, INC, ABSOLUTE,           6, false, RMW)     \
+    X(0xF0, BEQ, RELATIVE,           2, false, NONE)    \
+    X(0xF1, SBC, INDIRECT_Y,         5, true,  READ)    \
+    X(0xF5, SBC, ZERO_PAGE_X,        4, false, READ)    \
+    X(0xF6, INC, ZERO_PAGE_X,        6, false, RMW)     \
+    X(0xF8, SED, IMPLIED,            2, false, NONE)    \
+    X(0xF9, SBC, ABSOLUTE_Y,         4, true,  READ)    \
+    X(0xFD, SBC, ABSOLUTE_X,         4, true,  READ)    \
+    X(0xFE, INC, ABSOLUTE_X,         7, false, RMW)
+
+enum AddressingMode{
+#define ADDRESSING_MODE_ENUM(mode, length, format) MODE_##mode,
+    CPU_ADDRESSING_MODES(ADDRESSING_MODE_ENUM)
+#undef ADDRESSING_MODE_ENUM
 };
 
-enum addr_mode_1
-{
-    IndexedIndirectX,
-    ZeroPage,
-    Immediate,
-    Absolute,
-    IndirectY,
-    IndexedX,
-    AbsoluteY,
-    AbsoluteX,
+enum Operation{
+    OP_NONE,
+#define OPERATION_ENUM(operation) OP_##operation,
+    CPU_OPERATIONS(OPERATION_ENUM)
+#undef OPERATION_ENUM
 };
 
-enum operation_2
-{
-    ASL,
-    ROL,
-    LSR,
-    ROR,
-    STX,
-    LDX,
-    DEC,
-    INC,
+// What the operation does with the effective address
+enum Access{
+    ACCESS_NONE,
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_RMW
 };
 
-enum addr_mode_2
-{
-    Immediate_,
-    ZeroPage_,
-    Accumulator,
-    Absolute_,
-    Indexed         = 5,
-    AbsoluteIndexed = 7,
+// OPCODE_LDA_IMMEDIATE = 0xA9, and so on
+enum OpcodeValue{
+#define OPCODE_ENUM(opcode, operation, mode, cycles, page_penalty, access) OPCODE_##operation##_##mode = opcode,
+    CPU_OPCODES(OPCODE_ENUM)
+#undef OPCODE_ENUM
 };
 
-enum operation_0
-{
-    BIT = 1,
-    STY = 4,
-    LDY,
-    CPY,
-    CPX,
-};
-
-enum operation_implied
+enum branch_on_flag
 {
-    NOP  = 0xea,
-    BRK  = 0x00,
-    JSR  = 0x20,
-    RTI  = 0x40,
-    RTS  = 0x60,
-
-    JMP  = 0x4C,
-    JMPI = 0x6C, // JMP Indirect
-
-    PHP  = 0x08,
-    PLP  = 0x28,
-    PHA  = 0x48,
-    PLA  = 0x68,
-
-    DEY  = 0x88,
-    DEX  = 0xca,
-    TAY  = 0xa8,
-    INY  = 0xc8,
-    INX  = 0xe8,
-
-    CLC  = 0x18,
-    SEC  = 0x38,
-    CLI  = 0x58,
-    SEI  = 0x78,
-    TYA  = 0x98,
-    CLV  = 0xb8,
-    CLD  = 0xd8,
-    SED  = 0xf8,
-
-    TXA  = 0x8a,
-    TXS  = 0x9a,
-    TAX  = 0xaa,
-    TSX  = 0xba,
+    Negative,
+    Overflow,
+    Carry,
+    Zero
 };
 
 enum InterruptType
@@ -112,26 +230,4 @@ enum InterruptType
     BRK_
 };
 
-// 0 implies unused opcode
-static const int operation_cycles[0x100] = {
-        // clang-format off
-        7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-        6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-        6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-        6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-        0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,
-        2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,
-        2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,
-        2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
-        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-        2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 2, 4, 4, 6, 0,
-        2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
-        // clang-format on
-};
-
 #endif //EASYNES_CPUOPCODES_H
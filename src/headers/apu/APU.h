@@ -31,9 +31,16 @@ struct APU{
 
 typedef struct APU* apu;
 
+struct CPUBus;
+
 void    apu_init(apu a, audio_player player, irq_handle irq, uint8_t(*dmcDma)(cpu c, uint16_t));
 void    apu_step(apu a);
 void    write_register(apu a, uint16_t addr, uint8_t value);
 uint8_t read_status(apu a);
+// Sound registers, status and frame counter on the CPU bus
+void    apu_map_registers(apu a, struct CPUBus* b);
+// apu_step calls until the one raising the frame IRQ, included; -1 when none is coming
+int     apu_steps_until_frame_irq(apu a);
+int     apu_steps_until_dmc_fetch(apu a);
 
 #endif //EASYNES_APU_H
@@ -39,6 +39,8 @@ void    clear_interrupt(dmc d);
 
 void    dmc_clock(dmc d);
 uint8_t dmc_sample(dmc d);
+// dmc_clock calls until the next sample fetch (and possible IRQ), -1 when none is coming
+int     dmc_steps_until_fetch(dmc d);
 bool    has_more_samples(dmc d) { return d -> remaining_bytes > 0; }
 
 #endif //EASYNES_DMC_H
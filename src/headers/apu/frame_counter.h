@@ -59,6 +59,7 @@ void frame_counter_init(frame_counter fc,
 void frame_counter_clear_frame_interrupt(frame_counter fc);
 void frame_counter_reset(frame_counter fc, FrameCounterMode mode, bool irq_inhibit);
 void frame_counter_clock(frame_counter fc);
+int  frame_counter_clocks_until_irq(frame_counter fc);
 
 
 #endif //EASYNES_FRAME_COUNTER_H
@@ -14,6 +14,7 @@
 #include "controller.h"
 #include "cartridge.h"
 #include "apu/APU.h"
+#include "io.h"
 
 struct CPU;
 typedef struct CPU* cpu;
@@ -47,6 +48,21 @@ enum Register{
 
 typedef enum Register reg;
 
+// One mark per byte of RAM (0x800) and PRG-RAM (0x2000)
+#define CODE_MARKS_SIZE 0x2800
+
+// What handles a 256 byte page of the CPU address space when it has no direct pointer
+enum BusPage{
+    PAGE_OPEN_BUS,
+    PAGE_REGISTERS,   // 0x2000 - 0x401F, PPU, APU and controllers
+    PAGE_MAPPER,      // 0x8000 - 0xFFFF, writes are bank switches
+};
+
+// Watchpoint kinds, see bus_set_watch
+#define WATCH_READ      0x01
+#define WATCH_WRITE     0x02
+#define WATCH_EXECUTE   0x04    // checked by the CPU debug tier, not by the bus
+
 struct CPUBus {
     uint8_t* RAM;
     uint8_t* extRAM;
@@ -55,14 +71,67 @@ struct CPUBus {
     ppu ppu;
     apu apu;
     cs controller_set;
+
+    // Called before register accesses and mapper writes so PPU and APU can catch up with the CPU
+    void (*sync_callback)(void*);
+    void* sync_owner;
+
+    // Set on RAM/PRG-RAM bytes the CPU has decoded code from, writing one calls code_write_callback
+    uint8_t code_marks[CODE_MARKS_SIZE];
+    void (*code_write_callback)(void*, uint16_t);
+    void* code_write_owner;
+
+    // Page table: RAM, PRG-RAM and PRG-ROM pages point straight at host memory, a NULL
+    // pointer sends the access to page_handler. Writable pages also point at their code marks.
+    const uint8_t* read_page[0x100];
+    uint8_t* write_page[0x100];
+    uint8_t* mark_page[0x100];
+    uint8_t page_handler[0x100];
+
+    // Filled in by the PPU, APU and controllers, unmapped registers read as open bus
+    io_read_handler read_handler[IO_HANDLERS];
+    io_write_handler write_handler[IO_HANDLERS];
+    void* read_owner[IO_HANDLERS];
+    void* write_owner[IO_HANDLERS];
+
+    // WATCH_* of every address, NULL while none is set. Pages holding a read (write) watch
+    // have their pointer moved to watched_read_page (watched_write_page), so only their
+    // accesses take the slow path and get checked.
+    uint8_t* watch;
+    int watches;
+    const uint8_t* watched_read_page[0x100];
+    uint8_t* watched_write_page[0x100];
+    void (*watch_callback)(void*, uint16_t addr, uint8_t kind, uint8_t value);
+    void* watch_owner;
 };
 
 typedef struct CPUBus* bus;
 
 void           bus_init(bus b, ppu p, apu a, cs c, void (*dma)(ppu, uint8_t*));
-uint8_t        bus_read(bus b, uint16_t addr);
-void           bus_write(bus b, uint16_t addr, uint8_t value);
+uint8_t        bus_read_page(bus b, uint16_t addr);
+void           bus_write_page(bus b, uint16_t addr, uint8_t value);
 bool           setMapper(bus b, mapper mapper);
+void           set_sync_callback(bus b, void (*sync)(void*), void* owner);
+void           set_code_write_callback(bus b, void (*written)(void*, uint16_t), void* owner);
 const uint8_t* getPagePtr(bus b, uint8_t page);
+// Replaces the WATCH_* flags of addr, 0 clears them
+void           bus_set_watch(bus b, uint16_t addr, uint8_t kinds);
+void           set_watch_callback(bus b, void (*hit)(void*, uint16_t, uint8_t, uint8_t), void* owner);
+
+static inline uint8_t bus_read(bus b, uint16_t addr){
+    const uint8_t* page = b -> read_page[addr >> 8];
+    if(page) return page[addr & 0xFF];
+    return bus_read_page(b, addr);
+}
+
+static inline void bus_write(bus b, uint16_t addr, uint8_t value){
+    uint8_t* page = b -> write_page[addr >> 8];
+    if(!page){
+        bus_write_page(b, addr, value);
+        return;
+    }
+    page[addr & 0xFF] = value;
+    if(b -> mark_page[addr >> 8][addr & 0xFF]) b -> code_write_callback(b -> code_write_owner, addr);
+}
 
 #endif //EASYNES_BUS_H
@@ -40,11 +40,15 @@ struct controller_set{
 
 typedef struct controller_set* cs;
 
+struct CPUBus;
+
 void    controllerset_init(cs c);
 void    controller_init(controller c);
 void    controller_poll_host_input(cs c);
 void    controller_cpu_write(cs c, uint16_t addr, uint8_t value);
 uint8_t controller_cpu_read(cs c, uint16_t addr);
+// JOY1/JOY2 reads and the strobe write, 0x4017 writes belong to the APU frame counter
+void    controller_map_registers(cs c, struct CPUBus* b);
 uint8_t controller_read_serial(controller c);
 uint8_t read_pad_1_as_bitmask(cs c);
 uint8_t read_pad_2_as_bitmask(cs c);
@@ -11,23 +11,32 @@
 #include "bus.h"
 #include "irq.h"
 
-#define INSTRUCTION_MODE_MASK        0x3
-
-#define OPERATION_MASK               0xE0
-#define OPERATION_SHIFT              5
-
-#define ADDR_MODE_MASK               0x1C
-#define ADDR_MODE_SHIFT              2
-
-#define BRANCH_INSTR_MASK            0x1F
-#define BRANCH_INSTR_MASK_RESULT     0x10
 #define BRANCH_COND_MASK             0x20
 #define BRANCH_ON_FLAG_SHIFT         6
 
+// Status register bits, NV-BDIZC
+#define FLAG_N                       0x80
+#define FLAG_V                       0x40
+#define FLAG_U                       0x20  // unused, always pushed as 1
+#define FLAG_B                       0x10
+#define FLAG_D                       0x08
+#define FLAG_I                       0x04
+#define FLAG_Z                       0x02
+#define FLAG_C                       0x01
+
 #define NMI_VECTOR                   0xFFFA
 #define RESET_VECTOR                 0xFFFC
 #define IRQ_VECTOR                   0xFFFE
 
+// Decode cache slots: RAM, PRG-RAM and PRG-ROM
+#define DECODE_CACHE_SIZE            (CODE_MARKS_SIZE + 0x8000)
+
+// Longest polling loop, in bytes, that cpu_run fast-forwards
+#define IDLE_LOOP_MAX_LENGTH         8
+
+#define CPU_MAX_EVENTS               8
+#define CPU_NO_EVENT                 INT64_MAX
+
 struct IRQHandler{
     struct irq_h irq_handle;
     int bit;
@@ -36,23 +45,63 @@ struct IRQHandler{
 
 typedef struct IRQHandler* irq_handler;
 
-struct CPU{
-    int                   skip_cycles;
-    int                   cycles;
-
-    // Registers
+struct Registers{
     uint16_t              PC;
     uint8_t               SP;
     uint8_t               A;
     uint8_t               X;
     uint8_t               Y;
 
-    bool                  C;
-    bool                  Z;
-    bool                  I;
-    bool                  D;
-    bool                  V;
-    bool                  N;
+    // C, I, D and V at their status bit. N and Z are not stored: nz keeps the last result,
+    // Z is set when its low byte is 0 and N when bit 7 or 8 is (bit 8 only comes from PLP, RTI and BIT)
+    uint8_t               P;
+    uint16_t              nz;
+};
+
+typedef struct Registers* registers;
+
+static inline bool    flag_N(registers r) { return r -> nz & 0x180; }
+static inline bool    flag_Z(registers r) { return !(uint8_t)r -> nz; }
+
+// Status byte as pushed, B aside
+static inline uint8_t get_P(registers r){
+    return r -> P | FLAG_U | flag_N(r) << 7 | flag_Z(r) << 1;
+}
+
+static inline void    set_P(registers r, uint8_t flags){
+    r -> P  = flags & (FLAG_V | FLAG_D | FLAG_I | FLAG_C);
+    r -> nz = (uint16_t)(!(flags & FLAG_Z)) | (uint16_t)((flags & FLAG_N) << 1);
+}
+
+// Superinstructions: PRG-ROM sequences recognised at decode time and run by one handler
+enum Fusion{
+    FUSION_NONE,
+    FUSION_DEX_BNE,
+    FUSION_INY_CPY_IMM_BNE,
+    FUSION_INY_CPY_ZP_BNE,
+    FUSION_LDA_STA_ZP,
+    FUSION_LDA_PPU_STATUS_BPL,
+    FUSION_COUNT
+};
+
+struct DecodedInstruction{
+    uint32_t              tag;          // 0 when empty, PRG-ROM entries hold the mapper prg_generation
+    uint16_t              operand;      // operand bytes, little endian
+    uint8_t               opcode;
+    uint8_t               length;       // opcode byte included
+    uint8_t               fusion;       // enum Fusion of the sequence starting here
+    uint16_t              fused_operand; // operand bytes of the following instructions
+};
+
+struct CPU{
+    int                   skip_cycles;
+    int64_t               cycles;
+
+    // Tier cpu_run dispatches to, see cpu_find_core
+    const struct CPUCore* core;
+
+    // cpu_run works on a local copy and writes it back when the slice ends
+    struct Registers      regs;
 
     bool                  pending_NMI;
 
@@ -64,22 +113,97 @@ struct CPU{
     irq_handler*          irq_handlers;
     int                   irq_handlers_size;
     int                   irq_handlers_capacity;
+
+    // Cycles at which cpu_run hands control back to the caller, CPU_NO_EVENT when unarmed
+    int64_t               events[CPU_MAX_EVENTS];
+    int                   events_size;
+    int64_t               next_event;
+
+    struct DecodedInstruction* decode_cache;
+
+    // End of the running cpu_run slice (0 outside of it) and cycles skipped in idle loops
+    int64_t               run_end;
+    int64_t               idle_skipped_cycles;
+    int32_t               idle_branch;  // last idle loop branch seen, -1 for none
+    int64_t               idle_mark;    // cycle it was taken at
+
+    // Superinstructions run whole, and the cycles they took
+    int64_t               fusion_runs[FUSION_COUNT];
+    int64_t               fusion_cycles[FUSION_COUNT];
+
+    // Watchpoints and breakpoints, NULL unless debugger_create was called on this CPU
+    struct Debugger*      debugger;
+
+#ifdef CPU_DYNAREC
+    struct Dynarec*       dynarec;
+#endif
+#ifdef CPU_MAPPER_CORES
+    // PRG-ROM of a fixed bank mapper, read directly by the fast tier built for it
+    const uint8_t*        flat_prg;
+    uint16_t              flat_prg_mask;
+#endif
 };
 
 typedef struct CPU* cpu;
 
+// CPU core tiers: "debug", "reference", "fast" (threaded) and, in make dynarec builds, "recompiler".
+// The debug tier is the reference one with the breakpoint checks of debugger.h.
+// They share the registers and the state in struct CPU, so the tier can change between slices.
+struct CPUCore{
+    const char*           name;
+    int64_t               (*run)(cpu c, int64_t cycle_budget);
+    bool                  fast_paths;   // superinstructions and idle loop skipping
+};
+
+// Generated from CPU_OPCODES: runs the instruction, PC already past it, and adds its cycles
+typedef void (*opcode_handler)(cpu c, registers r, uint16_t operand);
+
+struct Opcode{
+    opcode_handler        handler;      // NULL for unused opcodes
+    uint8_t               cycles;       // base cycle count, 0 for unused opcodes
+    uint8_t               length;       // instruction length in bytes
+    uint8_t               operation;    // enum Operation
+    uint8_t               addressing;   // enum AddressingMode
+    uint8_t               access;       // enum Access
+    bool                  page_penalty; // an extra cycle is taken when indexing crosses a page
+};
+
 // IRQ Handler methods
 void       irq_init(irq_handler irq, int bit, cpu c);
 void       release(irq_handle irq);
 void       pull(irq_handle irq);
 
-bool       is_pending_IRQ(cpu c) { return !c -> I && c -> irq_pulldowns != 0; };
+static inline bool is_pending_IRQ(cpu c) { return !(c -> regs.P & FLAG_I) && c -> irq_pulldowns != 0; }
 
 void       cpu_init(cpu c, bus b);
 void       cpu_step(cpu c);
+// Runs the CPU for up to cycle_budget cycles, returns the cycles actually run.
+// Stops early on an instruction boundary when an interrupt becomes pending,
+// and one cycle before a scheduled event so the caller can sync the other chips.
+int64_t    cpu_run(cpu c, int64_t cycle_budget);
+// Tiers built in, slowest first: index past the last returns NULL
+const struct CPUCore* cpu_core(int index);
+// NULL when there is no such tier in this build
+const struct CPUCore* cpu_find_core(const char* name);
+void       cpu_set_core(cpu c, const struct CPUCore* core);
+// In CPU_MAPPER_CORES builds, moves a CPU on the fast tier to the build of it for m, if there is one
+void       cpu_use_mapper(cpu c, mapper m);
+// Tier given to the CPUs initialised from now on, the fastest one if never called
+void       cpu_set_default_core(const struct CPUCore* core);
+int        cpu_register_event(cpu c);
+void       cpu_schedule_event(cpu c, int event, int64_t cycle);
+void       cpu_cancel_event(cpu c, int event);
+const char* cpu_fusion_name(enum Fusion fusion);
+const struct Opcode* cpu_opcode(uint8_t opcode);
+// Writes the instruction in bytes (opcode and operand) at pc as assembly, returns its length
+int        cpu_disassemble(uint16_t pc, const uint8_t* bytes, char* buffer, size_t size);
+#ifdef CPU_DYNAREC
+// Interprets the instruction at r -> PC, interrupts aside, and returns its cycles (0 if illegal)
+int        cpu_interpret(cpu c, registers r);
+#endif
 void       cpu_reset(cpu c);
 void       cpu_addr_reset(cpu c,uint16_t start_addr);
-uint16_t   get_PC(cpu c) { return c -> PC; }
+static inline uint16_t get_PC(cpu c) { return c -> regs.PC; }
 void       skip_OAM_DMA_cycles(cpu c);
 void       skip_DMC_DMA_cycles(cpu c);
 void       nmi_interrupt(cpu c);
@@ -0,0 +1,57 @@
+#ifndef EASYNES_DEBUGGER_H
+#define EASYNES_DEBUGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+// Watchpoints and breakpoints for live debugging. Nothing is checked while none is armed:
+// read/write watches redirect only the bus pages they sit on, and arming anything moves the
+// CPU to the "debug" tier, which checks execute breakpoints and keeps the last instructions.
+// A hit stops cpu_run on the next instruction boundary and is dumped with debugger_dump.
+
+#define DEBUGGER_HISTORY     32      // instructions kept for the dump
+#define DEBUGGER_MAX_START   16      // watches set before the emulator starts
+
+struct DebuggerTrace{
+    uint16_t              PC;
+    uint8_t               bytes[3];     // opcode and operand
+    uint8_t               A, X, Y, P, SP;
+};
+
+struct Debugger{
+    cpu                   cpu;
+    const struct CPUCore* resume_core;  // tier to go back to once nothing is armed
+
+    struct DebuggerTrace  history[DEBUGGER_HISTORY];
+    int                   history_next;
+    int                   history_size;
+
+    bool                  hit;
+    uint8_t               hit_kind;     // WATCH_*
+    uint16_t              hit_addr;
+    uint8_t               hit_value;    // read or written, WATCH_READ/WATCH_WRITE only
+    uint16_t              hit_PC;       // instruction that caused it
+    bool                  resuming;     // don't stop again on the breakpoint just reported
+};
+
+typedef struct Debugger* debugger;
+
+// Sets the CPU (and its bus) up for watches, the ones given to debugger_watch_at_start included
+debugger   debugger_create(cpu c);
+// Adds (removes) WATCH_* kinds on addr
+void       debugger_watch(debugger d, uint16_t addr, uint8_t kinds);
+void       debugger_unwatch(debugger d, uint16_t addr, uint8_t kinds);
+// Watches armed by every debugger created from now on, for command line options
+void       debugger_watch_at_start(uint16_t addr, uint8_t kinds);
+// Logs the hit, the registers and the last instructions
+void       debugger_dump(debugger d);
+// Clears the hit so the CPU can go on
+void       debugger_resume(debugger d);
+static inline bool debugger_hit(debugger d) { return d && d -> hit; }
+
+// Called by the debug tier before every instruction, returns true on an execute breakpoint
+bool       debugger_instruction(debugger d, registers r, const struct DecodedInstruction* decoded);
+
+#endif //EASYNES_DEBUGGER_H
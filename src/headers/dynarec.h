@@ -0,0 +1,46 @@
+#ifndef EASYNES_DYNAREC_H
+#define EASYNES_DYNAREC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cpu.h"
+
+// Translates straight-line runs of PRG-ROM code to x86-64 (make dynarec).
+// Blocks keep the interpreter timing: they run whole only when they can't reach
+// the stop cycle, and leave register/mapper accesses to the interpreter.
+
+#define DYNAREC_BUFFER_SIZE          (8 << 20)
+#define DYNAREC_MAX_BLOCK_LENGTH     32       // 6502 instructions per block
+#define DYNAREC_MAX_BLOCK_BYTES      8192     // host code a block can take, bail-outs included
+
+// Translated code gets the registers, the 2 KiB of RAM and the bus, returns the cycles it ran
+typedef int (*block_code)(registers r, uint8_t* ram, bus b);
+
+struct DynarecBlock{
+    uint32_t              tag;          // mapper prg_generation it was translated for, 0 when empty
+    uint16_t              max_cycles;   // with every page cross and taken branch
+    uint8_t               length;       // 6502 instructions
+    block_code            code;         // NULL when the first instruction is left to the interpreter
+};
+
+struct Dynarec{
+    uint8_t*              buffer;       // executable, DYNAREC_BUFFER_SIZE bytes
+    size_t                used;
+    struct DynarecBlock   blocks[0x8000];
+
+    int64_t               translated;
+    int64_t               runs;
+    int64_t               flushes;
+    int64_t               mismatches;   // DYNAREC_DIFF only
+};
+
+typedef struct Dynarec* dynarec;
+
+dynarec    dynarec_create(void);
+// Runs the block at r -> PC if it ends within budget cycles, returns the cycles it took.
+// 0 means nothing ran and the interpreter must execute the next instruction.
+int        dynarec_execute(dynarec d, cpu c, registers r, int64_t budget);
+
+#endif //EASYNES_DYNAREC_H
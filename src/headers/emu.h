@@ -21,6 +21,7 @@
 #include "controller.h"
 #include "bus.h"
 #include "audio_player.h"
+#include "debugger.h"
 
 /* Dimensioni video NES (visibile) */
 enum {
@@ -51,6 +52,7 @@ typedef struct {
     mapper      mapper;          /* equivalente a unique_ptr<Mapper> */
     cs          controller_set;
     bus         bus;
+    debugger    debugger;        /* watchpoint: emulator_run si mette in pausa */
 
     /* Audio/video */
     audio_player     audio_player;
@@ -65,6 +67,15 @@ typedef struct {
     TimePointNS last_wakeup_ns;
     DurationNS  elapsed_ns;
 
+    /* Sincronizzazione: cicli CPU fino ai quali PPU e APU sono stati portati */
+    int64_t     ppu_cycles;
+    int64_t     apu_cycles;
+    int         vblank_event;
+    int         frame_irq_event;
+    int         dmc_event;
+    int         mapper_irq_event;
+    int64_t     mapper_irq_cycle;  /* ciclo dell'evento qui sopra, CPU_NO_EVENT se non c'è */
+
     /* Input */
     KeyMap      keys;
 
@@ -79,6 +90,10 @@ void emulator_dispose(Emulator *emu);
 /* Avvio ROM + main loop */
 void emulator_run(Emulator *emu, const char *rom_path);
 
+/* Sincronizzazione CPU/PPU/APU (emu_sync.c): da chiamare dopo i reset, poi la CPU gira a slice */
+void    emulator_start_timing(Emulator *emu);
+int64_t emulator_run_slice(Emulator *emu, int64_t budget);
+
 /* Settaggi video */
 void emulator_set_video_width (Emulator *emu, int width);
 void emulator_set_video_height(Emulator *emu, int height);
@@ -0,0 +1,20 @@
+#ifndef EASYNES_IO_H
+#define EASYNES_IO_H
+
+#include <stdint.h>
+
+// Register handlers of the CPU bus: 0x2000 - 0x3FFF mirror the 8 PPU registers,
+// 0x4000 - 0x401F come after them. Kept apart from bus.h so the APU, which has
+// its own register names, can plug into the bus.
+#define IO_HANDLERS     0x28
+#define IO_INDEX(addr)  ((addr) < 0x4000 ? (addr) & 0x7 : 0x8 + ((addr) & 0x1F))
+
+struct CPUBus;
+
+typedef uint8_t (*io_read_handler)(void* owner, uint16_t addr);
+typedef void    (*io_write_handler)(void* owner, uint16_t addr, uint8_t value);
+
+void set_register_reader(struct CPUBus* b, uint16_t addr, io_read_handler read, void* owner);
+void set_register_writer(struct CPUBus* b, uint16_t addr, io_write_handler write, void* owner);
+
+#endif //EASYNES_IO_H
@@ -24,41 +24,100 @@ typedef enum Type {
     GxROM       = 66,
 } mapper_type;
 
-// vtable semplice per mapper
+// CHR as the renderers read it: every 16 byte tile becomes its 8 rows of 8 pixel indices (0 - 3),
+// leftmost first, followed by the same rows flipped horizontally
+#define MAPPER_TILE_SIZE 128
+
+// Every mapper keeps the banks it has selected in prg_bank and chr_bank and points the buses at
+// them, so a bank switch is a few pointer stores and reads never go through the mapper.
+// Mappers only handle register writes (cpu_write) and call mapper_select_prg/chr from there.
 struct Mapper {
     uint8_t (*cpu_read)(struct Mapper*, uint16_t addr);
+    // Register writes to 0x8000 - 0xFFFF
     void    (*cpu_write)(struct Mapper*, uint16_t addr, uint8_t v);
     uint8_t (*chr_read)(struct Mapper*, uint16_t addr);
     void    (*chr_write)(struct Mapper*, uint16_t addr, uint8_t v);
     void    (*reset)(struct Mapper*);
+    // Points the CPU bus at the banks currently selected, called by setMapper and on bank switches
+    void    (*map_prg)(struct Mapper*);
+    // Points the picture bus at the CHR banks currently selected, called by set_mapper and on bank switches
+    void    (*map_chr)(struct Mapper*);
 
-    enum mirror_type (*get_mirror_type)();
-
-    void    (*scanlineIRQ)();
+    // Scanline counters (MMC3) are clocked by the PPU line_clocks and only brought up to date here:
+    // catches up to line_clocks, raising the IRQ if it went off on the way, and returns the clocks
+    // left until the next IRQ, 0 when none will come. NULL for mappers without a counter
+    int     (*irq_clocks)(struct Mapper*, int64_t line_clocks);
 
     cartridge cart;
     mapper_type m_type;
+
+    // Starts at 1 and must be bumped whenever the PRG-ROM seen by the CPU changes,
+    // decoded instructions cached by the CPU are dropped when it does
+    uint32_t prg_generation;
+
+    // 8 KiB banks at 0x8000, 0xA000, 0xC000, 0xE000 and 1 KiB banks at 0x0000 - 0x1C00
+    const uint8_t* prg_bank[4];
+    uint8_t*       chr_bank[8];
+
+    uint32_t prg_size;
+    uint8_t* chr;               // CHR-ROM, or the cartridge CHR-RAM
+    uint32_t chr_size;
+    bool     chr_writable;
+    uint8_t* chr_tiles;         // chr decoded, MAPPER_TILE_SIZE bytes per tile
+
+    enum mirror_type mirroring;
+    // Called when the mapper switches mirroring, the picture bus remaps its nametables
+    void (*mirroring_callback)(void* owner);
+    void* mirroring_owner;
+    // Called after writes that change when irq_clocks fires, so the emulator can reschedule it
+    void (*irq_callback)(void* owner);
+    void* irq_owner;
+    // PPU line_clocks, up to date whenever the bus hands the mapper a write. NULL until set_irq_callback
+    const int64_t* line_clocks;
+
+    // CPU bus pages for 0x8000 - 0xFFFF, NULL until the mapper is plugged into the bus
+    const uint8_t** prg_pages;
+    // Picture bus 1 KiB slots for 0x0000 - 0x1FFF, the writable ones stay NULL for CHR-ROM
+    uint8_t** chr_pages;
+    uint8_t** chr_write_pages;
+    // Decoded tiles of the same slots
+    uint8_t** chr_tile_pages;
 };
 
 typedef struct Mapper* mapper;
 
 #include "mapper_nrom.h"
+#include "mapper_mmc1.h"
+#include "mapper_uxrom.h"
+#include "mapper_cnrom.h"
+#include "mapper_axrom.h"
+#include "mapper_gxrom.h"
+#include "mapper_mmc3.h"
 #include "irq.h"
 
-void create_mapper(mapper m, cartridge cart,
-                   irq_handle irq
-                    /*void (*mirroring_cb)(void)*/);
-
-
-mapper mapper_mmc1_create(cartridge cart);  // ritorna NULL se alloc fallisce
-
-mapper create_mapper_for_cart(cartridge cart);
-
-static void mmc1_remap_prg(mapper m);
-static void mmc1_remap_chr(mapper m);
-static void mmc1_write_control(mapper m, uint8_t v);
-
-bool inline hasExtendedRAM(mapper m) { return true; }
+// Returns NULL for mappers we don't support
+mapper create_mapper(cartridge cart, irq_handle irq);
+void   mapper_destroy(mapper m);
+
+// Allocates size bytes for a mapper struct starting with struct Mapper and sets up the shared part:
+// PRG-ROM at 0x8000 and 0xC000 (mirrored when there is only 16 KiB), the first 8 KiB of CHR
+mapper mapper_alloc(size_t size, cartridge cart, mapper_type type);
+
+// Selects bank (in size units, wrapped around the ROM) for the size bytes at addr
+void mapper_select_prg(mapper m, uint16_t addr, uint32_t bank, uint32_t size);
+void mapper_select_chr(mapper m, uint16_t addr, uint32_t bank, uint32_t size);
+void mapper_set_mirroring(mapper m, enum mirror_type mirroring);
+void set_mirroring_callback(mapper m, void (*callback)(void* owner), void* owner);
+void set_irq_callback(mapper m, void (*callback)(void* owner), void* owner, const int64_t* line_clocks);
+
+// Maps size bytes of PRG-ROM from bank at addr (both multiples of 256) and bumps prg_generation
+void mapper_map_prg(mapper m, uint16_t addr, const uint8_t* bank, uint32_t size);
+// Maps size bytes of CHR memory from bank at addr (both multiples of 1 KiB), writes go to CHR-RAM only
+void mapper_map_chr(mapper m, uint16_t addr, uint8_t* bank, uint32_t size, bool writable);
+// Decodes again the tile row holding byte offset of chr, after a CHR-RAM write
+void mapper_decode_chr(mapper m, uint32_t offset);
+
+static inline bool hasExtendedRAM(mapper m) { (void)m; return true; }
 
 
 #endif //EASYNES_MAPPER_H
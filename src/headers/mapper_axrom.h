@@ -0,0 +1,10 @@
+#ifndef EASYNES_MAPPER_AXROM_H
+#define EASYNES_MAPPER_AXROM_H
+
+#include "mapper.h"
+
+// factory per AxROM (mapper 7)
+mapper mapper_axrom_create(cartridge cart);
+
+
+#endif //EASYNES_MAPPER_AXROM_H
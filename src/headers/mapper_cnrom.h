@@ -0,0 +1,10 @@
+#ifndef EASYNES_MAPPER_CNROM_H
+#define EASYNES_MAPPER_CNROM_H
+
+#include "mapper.h"
+
+// factory per CNROM (mapper 3)
+mapper mapper_cnrom_create(cartridge cart);
+
+
+#endif //EASYNES_MAPPER_CNROM_H
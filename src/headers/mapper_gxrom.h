@@ -0,0 +1,10 @@
+#ifndef EASYNES_MAPPER_GXROM_H
+#define EASYNES_MAPPER_GXROM_H
+
+#include "mapper.h"
+
+// factory per GxROM (mapper 66)
+mapper mapper_gxrom_create(cartridge cart);
+
+
+#endif //EASYNES_MAPPER_GXROM_H
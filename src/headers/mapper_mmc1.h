@@ -0,0 +1,29 @@
+//
+// Created by Dario Bonfiglio on 10/12/25.
+//
+
+#ifndef EASYNES_MAPPER_MMC1_H
+#define EASYNES_MAPPER_MMC1_H
+
+#include "mapper.h"
+
+struct mapper_mmc1{
+    struct Mapper base;
+
+    // Registers are written one bit at a time, the fifth write loads the one picked by the address
+    uint8_t shift;
+    uint8_t shift_count;
+
+    uint8_t control;        // mirroring, PRG mode (bits 2-3), CHR mode (bit 4)
+    uint8_t chr_bank0;
+    uint8_t chr_bank1;
+    uint8_t prg_bank;
+};
+
+typedef struct mapper_mmc1* mmc1;
+
+// factory per MMC1 / SxROM (mapper 1)
+mapper mapper_mmc1_create(cartridge cart);
+
+
+#endif //EASYNES_MAPPER_MMC1_H
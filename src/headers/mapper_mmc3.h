@@ -0,0 +1,27 @@
+#ifndef EASYNES_MAPPER_MMC3_H
+#define EASYNES_MAPPER_MMC3_H
+
+#include "mapper.h"
+#include "irq.h"
+
+struct mapper_mmc3{
+    struct Mapper base;
+    irq_handle irq;
+
+    uint8_t bank_select;    // register picked by 0x8001 (bits 0-2), PRG mode (bit 6), CHR inversion (bit 7)
+    uint8_t banks[8];
+
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+    int64_t line_clocks;    // PPU line clocks irq_counter has been brought up to
+};
+
+typedef struct mapper_mmc3* mmc3;
+
+// factory per MMC3 / TxROM (mapper 4)
+mapper mapper_mmc3_create(cartridge cart, irq_handle irq);
+
+
+#endif //EASYNES_MAPPER_MMC3_H
@@ -0,0 +1,10 @@
+#ifndef EASYNES_MAPPER_UXROM_H
+#define EASYNES_MAPPER_UXROM_H
+
+#include "mapper.h"
+
+// factory per UxROM (mapper 2)
+mapper mapper_uxrom_create(cartridge cart);
+
+
+#endif //EASYNES_MAPPER_UXROM_H
@@ -5,17 +5,33 @@
 #ifndef EASYNES_PBUS_H
 #define EASYNES_PBUS_H
 
+#include <string.h>
+
 #include "mapper.h"
 #include "cartridge.h"
 
+// 1 KiB slots of the 16 KiB PPU space: 0-7 pattern tables, 8-11 nametables, 12-15 their mirror
+#define PBUS_SLOTS     16
+#define PBUS_SLOT_SIZE 0x400
+
 struct picture_bus{
-    size_t nametable0, nametable1, nametable2, nametable3;
+    // Where every slot reads from, and writes to (NULL for CHR-ROM). Only the palette,
+    // 0x3F00 - 0x3FFF at the end of slot 15, is handled apart.
+    uint8_t* slot[PBUS_SLOTS];
+    uint8_t* write_slot[PBUS_SLOTS];
+    // Decoded tiles of the pattern table slots, see MAPPER_TILE_SIZE
+    uint8_t* tile_slot[8];
+
     uint8_t* palette;
     uint8_t* ram;
     mapper mapper;
 
     size_t palette_size;
     size_t RAM_size;
+
+    // Called after a palette write with the entry written (0x10, 0x14, 0x18, 0x1C come as their mirror)
+    void (*palette_callback)(void* owner, uint8_t palette_addr);
+    void* palette_owner;
 };
 
 typedef struct picture_bus* pbus;
@@ -23,12 +39,25 @@ typedef struct picture_bus* pbus;
 pbus pbus_init(pbus pb);
 void pbus_destroy(pbus pb);
 
-uint8_t pbread(pbus p, uint16_t addr);
 void pbwrite(pbus p, uint16_t addr, uint8_t value);
 
 bool set_mapper(pbus p, mapper m);
+void set_palette_callback(pbus p, void (*callback)(void* owner, uint8_t palette_addr), void* owner);
 uint8_t read_palette(pbus p, uint16_t palette_addr);
 void update_mirroring(pbus p);
-void scanline_IRQ(pbus p);
+
+static inline uint8_t pbread(pbus p, uint16_t addr){
+    addr = addr & 0x3FFF;
+    if(addr >= 0x3F00) return read_palette(p, addr & 0x1F);
+    return p -> slot[addr >> 10][addr & 0x3FF];
+}
+
+// Pixel indices of the pattern row whose low plane is at addr, leftmost in the lowest byte
+// (little endian hosts), mirrored when flip. One load instead of combining the planes bit by bit.
+static inline uint64_t pbus_tile_row(pbus p, uint16_t addr, bool flip){
+    uint64_t row;
+    memcpy(&row, p -> tile_slot[(addr >> 10) & 7] + ((addr & 0x3F0) >> 4) * MAPPER_TILE_SIZE + (addr & 7) * 8 + (flip ? 64 : 0), sizeof(row));
+    return row;
+}
 
 #endif //EASYNES_PBUS_H
@@ -22,24 +22,19 @@
 #include "pbus.h"
 
 typedef struct CPU* cpu;
+struct CPUBus;
 
 typedef struct {
     int width;
     int height;
-    Color *pixels;     // length = width * height
+    uint8_t *indices;  // length = width * height, NES colours (0 - 63) written by the PPU
+    uint8_t *emphasis; // length = height, PPUMASK emphasis bits each line started with
+    Color *pixels;     // length = width * height, host colours filled from indices by PBResolve
     Texture2D tex;     // opzionale: texture GPU per disegnare veloce
 } PictureBuffer;
 
 typedef PictureBuffer* p_buffer;
 
-typedef struct {
-    uint8_t *data;     // array dinamico di byte
-    size_t size;       // quanti elementi sono usati (come .size())
-    size_t capacity;   // capacità allocata (come .capacity())
-} ByteVector;
-
-typedef ByteVector* bv;
-
 #define PB_INDEX(pb, x, y) ((y)*(pb)->width + (x))
 
 
@@ -63,53 +58,89 @@ typedef enum character_page{
 
 struct Mapper;
 
-struct PPU {
-    void (*vblank_callback)(cpu);
-    pbus bus;
-    bv sprite_memory;
-    bv scanline_sprites;
+// sprite_line flags next to the palette address (0x10 - 0x1F) of the sprite pixel
+#define SPRITE_BEHIND   0x20        // behind opaque background
+#define SPRITE_ZERO     0x40        // drawn by sprite 0, for the hit flag
 
-    ppu_state pipeline_state;
+#define PPU_CACHE_LINE  64
 
+// Allocate with aligned_alloc(_Alignof(struct PPU), ...): the per dot fields come first and the
+// tables rendering reads every dot or line sit on their own cache lines
+struct PPU {
+    ppu_state pipeline_state;
     int cycle;
     int scanline;
-    bool even_frame;
-
-    bool vblank;
-    bool sprite_zero_hit;
-    bool sprite_overflow;
 
     uint16_t data_address, temp_address;        // current/temporary VRAM address
     uint8_t fine_x_scroll;                      // fine X (3 bit)
-    uint8_t first_write;                        // write toggle (0/1)
-    uint8_t data_buffer;
-
-    uint8_t sprite_data_address;
-
-    bool long_sprite;
-    bool generate_interrupt;
-
-    bool grayscale_mode;
     bool show_sprites;
     bool show_background;
     bool hide_edge_sprites;
     bool hide_edge_backgound;
+    bool sprite_zero_hit;
 
+    // Background pipeline: one tile fetched every 8 dots, the shift registers move once per dot
+    uint8_t bg_next_tile, bg_next_attribute;
+    uint8_t bg_next_low, bg_next_high;
+    uint16_t bg_shift_low, bg_shift_high;                       // pattern planes, current tile in the high byte
+    uint16_t bg_shift_attribute_low, bg_shift_attribute_high;   // palette bits spread over the 8 pixels
     character_page bg_page;
+
+    pbus bus;
+    p_buffer picture_buffer;
+
+    // The 32 palette entries as NES colours, grayscale applied. Redone on palette writes and when
+    // PPUMASK changes it, so a pixel is one load from here. Emphasis is kept per line in the picture buffer
+    _Alignas(PPU_CACHE_LINE) uint8_t palette_indices[32];
+    // Sprite pixels of the current line, fetched on the line before: palette address and SPRITE_* flags, 0 where none
+    _Alignas(PPU_CACHE_LINE) uint8_t sprite_line[SCANLINE_VISIBLE_DOTS];
+
+    // OAM, and the secondary OAM the entries on the next line are copied to, in order
+    _Alignas(PPU_CACHE_LINE) uint8_t sprite_memory[256];
+    _Alignas(PPU_CACHE_LINE) uint8_t secondary_oam[32];
+    uint8_t secondary_count;
+    bool line_sprite_zero;                      // the first entry of secondary_oam counts as sprite 0
+    bool long_sprite;
     character_page spr_page;
+    uint8_t sprite_data_address;
+
+    bool even_frame;
+    // Dot 260 of every line fetched with rendering on, clocks the mapper scanline counter
+    int64_t line_clocks;
 
+    bool vblank;
+    bool sprite_overflow;
+
+    uint8_t first_write;                        // write toggle (0/1)
+    uint8_t data_buffer;
     uint16_t data_address_increment;
 
-    p_buffer picture_buffer;
+    bool generate_interrupt;
+    bool grayscale_mode;
+    uint8_t emphasis;                           // PPUMASK bits 5-7: red, green, blue
+
+    void (*vblank_callback)(cpu);
+    // Called when PPUMASK turns rendering on or off, which starts or stops line_clocks
+    void (*rendering_callback)(void* owner);
+    void* rendering_owner;
 };
 
 typedef struct PPU* ppu;
 
 void create_ppu(ppu pp, pbus pb);
 void step(ppu pp, cpu c);
+// Same as dots step calls, with whole visible and blank lines done at once. Register accesses
+// sync the PPU first, so none falls within a run and only the lines they split go dot by dot.
+void ppu_run(ppu pp, cpu c, int64_t dots);
 void reset(ppu pp);
+// Number of step calls until the one that sets the vblank flag, included
+int  ppu_dots_until_vblank(ppu pp);
+// Number of step calls until the one making the clocks-th line clock from now, included,
+// as long as rendering stays on. -1 when it is off
+int  ppu_dots_until_line_clock(ppu pp, int clocks);
 
 void setInterruptCallback(ppu pp, void(*cb)(cpu));
+void set_rendering_callback(ppu pp, void (*callback)(void* owner), void* owner);
 
 void doDMA(ppu pp, uint8_t* page_ptr);
 
@@ -126,14 +157,18 @@ uint8_t getStatus(ppu pp);
 uint8_t getData(ppu pp);
 uint8_t getOAMData(ppu pp);
 void setOAMData(ppu pp, uint8_t value);
+// Plugs the callbacks above into the CPU bus register table
+void ppu_map_registers(ppu pp, struct CPUBus* b);
 
 void DEBUG_goto_scanline_dot(ppu ppu, int32_t scanline, int32_t dot);
 
-static inline void PBSet(PictureBuffer *pb, int x, int y, Color c);
-static inline Color PBGet(const PictureBuffer *pb, int x, int y);
+static inline void PBSet(PictureBuffer *pb, int x, int y, uint8_t index);
+static inline uint8_t PBGet(const PictureBuffer *pb, int x, int y);
 bool PBInit(PictureBuffer *pb, int width, int height, Color fill);
 void PBFree(PictureBuffer *pb);
-void PBClear(PictureBuffer *pb, Color fill);
+void PBClear(PictureBuffer *pb, uint8_t index);
+// Converts the indices to pixels, only when the frame is shown. Reads nothing of the PPU
+void PBResolve(PictureBuffer *pb);
 void PBFlushToGPU(PictureBuffer *pb);
 
 #endif //EASYNES_PPU_H
@@ -25,8 +25,40 @@ static void rl_panic(const char *what) {
 int main(int argc, char const *argv[]) {
     log_init("log/easynes.log");
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <game>.nes\n", argc > 0 ? argv[0] : "easynes");
+    // easynes [--cpu=<tier>] [--break=<addr>] [--watch=<addr>[:r|w|rw]] <game>.nes
+    const char *rom_path = NULL;
+    bool        bad_args = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "--cpu=", 6)) {
+            const struct CPUCore *core = cpu_find_core(argv[i] + 6);
+            if (!core) {
+                fprintf(stderr, "Unknown CPU tier %s, available:", argv[i] + 6);
+                for (int t = 0; cpu_core(t); ++t) fprintf(stderr, " %s", cpu_core(t) -> name);
+                fprintf(stderr, "\n");
+                bad_args = true;
+            } else {
+                cpu_set_default_core(core);
+            }
+        } else if (!strncmp(argv[i], "--break=", 8) || !strncmp(argv[i], "--watch=", 8)) {
+            // Hex address, watches take reads and writes unless told otherwise
+            char         *end;
+            unsigned long addr  = strtoul(argv[i] + 8, &end, 16);
+            uint8_t       kinds = argv[i][2] == 'b' ? WATCH_EXECUTE : WATCH_READ | WATCH_WRITE;
+            if (kinds != WATCH_EXECUTE && *end == ':') {
+                kinds = (strchr(end, 'r') ? WATCH_READ : 0) | (strchr(end, 'w') ? WATCH_WRITE : 0);
+                end  += strspn(end + 1, "rw") + 1;
+            }
+            if (end == argv[i] + 8 || *end || addr > 0xFFFF || !kinds) bad_args = true;
+            else debugger_watch_at_start((uint16_t)addr, kinds);
+        } else if (!rom_path) {
+            rom_path = argv[i];
+        } else {
+            bad_args = true;
+        }
+    }
+
+    if (bad_args || !rom_path) {
+        fprintf(stderr, "Usage: %s [--cpu=<tier>] [--break=<addr>] [--watch=<addr>[:r|w|rw]] <game>.nes\n", argc > 0 ? argv[0] : "easynes");
         log_stop();
         return EXIT_FAILURE;
     }
@@ -4,35 +4,167 @@
 
 #include "headers/mapper.h"
 
-void create_mapper(mapper m, cartridge cart,
-                   irq_handle irq
-                   /*void (*mirroring_cb)(void)*/) {
+mapper create_mapper(cartridge cart, irq_handle irq){
     switch (cart -> header.mapper_id) {
         case NROM:
-            m = mapper_nrom_create(cart);
-            break;
-        /* case SxROM:
-            ret -> reset(mapper_mmc1_create(cart, mirroring_cb));
-            break;
-         case UxROM:
-            ret -> reset(new MapperUxROM(cart));
-            break;
+            return mapper_nrom_create(cart);
+        case SxROM:
+            return mapper_mmc1_create(cart);
+        case UxROM:
+            return mapper_uxrom_create(cart);
         case CNROM:
-            ret -> reset(new MapperCNROM(cart));
-            break;
-        case MMC3:
-            ret -> reset(new MapperMMC3(cart, irq, mirroring_cb));
-            break;
+            return mapper_cnrom_create(cart);
         case AxROM:
-            ret -> reset(new MapperAxROM(cart, mirroring_cb));
-            break;
-        case ColorDreams:
-            ret -> reset(new MapperColorDreams(cart, mirroring_cb));
-            break;
+            return mapper_axrom_create(cart);
         case GxROM:
-            ret -> reset(new MapperGxROM(cart, mirroring_cb));
+            return mapper_gxrom_create(cart);
+        case MMC3:
+            return mapper_mmc3_create(cart, irq);
+        /* case ColorDreams:
+            ret -> reset(new MapperColorDreams(cart, mirroring_cb));
             break; */
         default:
-            break;
+            perror("Mapper %d is not supported", cart -> header.mapper_id);
+            return NULL;
+    }
+}
+
+void mapper_destroy(mapper m){
+    free(m -> chr_tiles);
+    free(m);
+}
+
+// Only taken by the watched pages of the debugger, everything else reads the banks from the buses
+static uint8_t read_prg(mapper m, uint16_t addr){
+    return m -> prg_bank[(addr >> 13) & 3][addr & 0x1FFF];
+}
+
+static void write_rom(mapper m, uint16_t addr, uint8_t v){
+    (void)m;
+    perror("ROM memory write to attempt at 0x%04X to set %d", addr, v);
+}
+
+static uint8_t read_chr(mapper m, uint16_t addr){
+    return m -> chr_bank[(addr >> 10) & 7][addr & 0x3FF];
+}
+
+static void write_chr(mapper m, uint16_t addr, uint8_t v){
+    if(m -> chr_writable){
+        m -> chr_bank[(addr >> 10) & 7][addr & 0x3FF] = v;
+        mapper_decode_chr(m, m -> chr_bank[(addr >> 10) & 7] + (addr & 0x3FF) - m -> chr);
+    }
+    else perror("Read-only CHR memory write to attempt at 0x%04X to set %d", addr, v);
+}
+
+static void map_prg(mapper m){
+    for(int slot = 0; slot < 4; ++slot) mapper_map_prg(m, 0x8000 + slot * 0x2000, m -> prg_bank[slot], 0x2000);
+}
+
+static void map_chr(mapper m){
+    for(int slot = 0; slot < 8; ++slot) mapper_map_chr(m, slot * 0x400, m -> chr_bank[slot], 0x400, m -> chr_writable);
+}
+
+mapper mapper_alloc(size_t size, cartridge cart, mapper_type type){
+    mapper m = (mapper)calloc(1, size);
+    if(!m){
+        perror("Error allocating mapper %d", type);
+        exit(EXIT_FAILURE);
+    }
+
+    m -> cart = cart;
+    m -> m_type = type;
+    m -> prg_generation = 1;
+    m -> cpu_read = read_prg;
+    m -> cpu_write = write_rom;
+    m -> chr_read = read_chr;
+    m -> chr_write = write_chr;
+    m -> map_prg = map_prg;
+    m -> map_chr = map_chr;
+
+    m -> prg_size = KIB(cart -> header.prg_rom_size_bytes);
+    if(cart -> header.chr_rom_size_bytes == 0){
+        m -> chr = cart -> chr_ram;
+        m -> chr_size = 0x2000;
+        m -> chr_writable = true;
+    } else {
+        m -> chr = cart -> chr_rom;
+        m -> chr_size = KIB(cart -> header.chr_rom_size_bytes);
+        m -> chr_writable = false;
+    }
+    m -> mirroring = cart -> header.mirroring;
+
+    m -> chr_tiles = (uint8_t*)malloc((size_t)m -> chr_size / 16 * MAPPER_TILE_SIZE);
+    if(!m -> chr_tiles){
+        perror("Error allocating decoded CHR of mapper %d", type);
+        exit(EXIT_FAILURE);
+    }
+    for(uint32_t tile = 0; tile < m -> chr_size; tile += 16)
+        for(uint32_t row = 0; row < 8; ++row) mapper_decode_chr(m, tile + row);
+
+    mapper_select_prg(m, 0x8000, 0, 0x4000);
+    mapper_select_prg(m, 0xC000, 1, 0x4000);
+    mapper_select_chr(m, 0x0000, 0, 0x2000);
+    return m;
+}
+
+void mapper_select_prg(mapper m, uint16_t addr, uint32_t bank, uint32_t size){
+    for(uint32_t i = 0; i < size; i += 0x2000){
+        const uint8_t* page = m -> cart -> prg_rom + (bank * size + i) % m -> prg_size;
+        // Rewriting the same bank would still drop the decoded instructions
+        if(m -> prg_bank[((addr + i) >> 13) & 3] == page) continue;
+        m -> prg_bank[((addr + i) >> 13) & 3] = page;
+        mapper_map_prg(m, addr + i, page, 0x2000);
+    }
+}
+
+void mapper_select_chr(mapper m, uint16_t addr, uint32_t bank, uint32_t size){
+    for(uint32_t i = 0; i < size; i += 0x400){
+        uint8_t* page = m -> chr + (bank * size + i) % m -> chr_size;
+        m -> chr_bank[(addr + i) >> 10] = page;
+        mapper_map_chr(m, addr + i, page, 0x400, m -> chr_writable);
+    }
+}
+
+void mapper_set_mirroring(mapper m, enum mirror_type mirroring){
+    if(m -> mirroring == mirroring) return;
+    m -> mirroring = mirroring;
+    if(m -> mirroring_callback) m -> mirroring_callback(m -> mirroring_owner);
+}
+
+void set_mirroring_callback(mapper m, void (*callback)(void* owner), void* owner){
+    m -> mirroring_callback = callback;
+    m -> mirroring_owner = owner;
+}
+
+void set_irq_callback(mapper m, void (*callback)(void* owner), void* owner, const int64_t* line_clocks){
+    m -> irq_callback = callback;
+    m -> irq_owner = owner;
+    m -> line_clocks = line_clocks;
+}
+
+void mapper_map_prg(mapper m, uint16_t addr, const uint8_t* bank, uint32_t size){
+    ++m -> prg_generation;
+    if(!m -> prg_pages) return;
+    for(uint32_t offset = 0; offset < size; offset += 0x100)
+        m -> prg_pages[((addr + offset) >> 8) - 0x80] = bank + offset;
+}
+
+void mapper_map_chr(mapper m, uint16_t addr, uint8_t* bank, uint32_t size, bool writable){
+    if(!m -> chr_pages) return;
+    for(uint32_t offset = 0; offset < size; offset += 0x400){
+        m -> chr_pages[(addr + offset) >> 10]       = bank + offset;
+        m -> chr_write_pages[(addr + offset) >> 10] = writable ? bank + offset : NULL;
+        m -> chr_tile_pages[(addr + offset) >> 10]  = m -> chr_tiles + (bank + offset - m -> chr) / 16 * MAPPER_TILE_SIZE;
+    }
+}
+
+void mapper_decode_chr(mapper m, uint32_t offset){
+    // Low plane of the row, the high one is 8 bytes after it
+    const uint8_t* planes = m -> chr + (offset & ~0x8u);
+    uint8_t* row = m -> chr_tiles + (offset >> 4) * MAPPER_TILE_SIZE + (offset & 7) * 8;
+    for(int i = 0; i < 8; ++i){
+        uint8_t pixel = ((planes[0] >> (7 - i)) & 1) | (((planes[8] >> (7 - i)) & 1) << 1);
+        row[i]          = pixel;
+        row[64 + 7 - i] = pixel;
     }
 }
@@ -0,0 +1,16 @@
+#include "headers/mapper_axrom.h"
+
+// 32 KiB PRG-ROM banks, CHR-RAM, bit 4 picks the nametable shown on the whole screen
+static void axrom_write(mapper m, uint16_t addr, uint8_t v){
+    (void)addr;
+    mapper_select_prg(m, 0x8000, v & 7, 0x8000);
+    mapper_set_mirroring(m, v & 0x10 ? ONE_SCREEN_HIGHER : ONE_LOWER_SCREEN);
+}
+
+mapper mapper_axrom_create(cartridge cart){
+    mapper m = mapper_alloc(sizeof(struct Mapper), cart, AxROM);
+    m -> cpu_write = axrom_write;
+    m -> mirroring = ONE_LOWER_SCREEN;
+    mapper_select_prg(m, 0x8000, 0, 0x8000);
+    return m;
+}
@@ -0,0 +1,13 @@
+#include "headers/mapper_cnrom.h"
+
+// Fixed PRG-ROM like NROM, 8 KiB CHR-ROM banks
+static void cnrom_write(mapper m, uint16_t addr, uint8_t v){
+    (void)addr;
+    mapper_select_chr(m, 0x0000, v & 3, 0x2000);
+}
+
+mapper mapper_cnrom_create(cartridge cart){
+    mapper m = mapper_alloc(sizeof(struct Mapper), cart, CNROM);
+    m -> cpu_write = cnrom_write;
+    return m;
+}
@@ -0,0 +1,15 @@
+#include "headers/mapper_gxrom.h"
+
+// 32 KiB PRG-ROM banks (bits 4-5) and 8 KiB CHR-ROM banks (bits 0-1)
+static void gxrom_write(mapper m, uint16_t addr, uint8_t v){
+    (void)addr;
+    mapper_select_prg(m, 0x8000, (v >> 4) & 3, 0x8000);
+    mapper_select_chr(m, 0x0000, v & 3, 0x2000);
+}
+
+mapper mapper_gxrom_create(cartridge cart){
+    mapper m = mapper_alloc(sizeof(struct Mapper), cart, GxROM);
+    m -> cpu_write = gxrom_write;
+    mapper_select_prg(m, 0x8000, 0, 0x8000);
+    return m;
+}
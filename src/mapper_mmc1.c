@@ -6,4 +6,89 @@
 #include "headers/mapper.h"
 #include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
\ No newline at end of file
+#include <stdint.h>
+
+static void mmc1_remap_prg(mmc1 m){
+    // 512 KiB boards (SUROM) pick the 256 KiB half with bit 4 of the CHR registers
+    uint32_t outer = m -> base.prg_size > 0x40000 ? (m -> chr_bank0 & 0x10) : 0;
+    uint32_t bank  = outer | (m -> prg_bank & 0x0F);
+
+    switch ((m -> control >> 2) & 3) {
+        case 0:
+        case 1:
+            mapper_select_prg(&m -> base, 0x8000, bank >> 1, 0x8000);
+            break;
+        case 2:
+            mapper_select_prg(&m -> base, 0x8000, outer, 0x4000);
+            mapper_select_prg(&m -> base, 0xC000, bank, 0x4000);
+            break;
+        case 3:
+            mapper_select_prg(&m -> base, 0x8000, bank, 0x4000);
+            mapper_select_prg(&m -> base, 0xC000, outer | 0x0F, 0x4000);
+            break;
+    }
+}
+
+static void mmc1_remap_chr(mmc1 m){
+    if (m -> control & 0x10) {
+        mapper_select_chr(&m -> base, 0x0000, m -> chr_bank0, 0x1000);
+        mapper_select_chr(&m -> base, 0x1000, m -> chr_bank1, 0x1000);
+    } else {
+        mapper_select_chr(&m -> base, 0x0000, m -> chr_bank0 >> 1, 0x2000);
+    }
+}
+
+static void mmc1_write_control(mmc1 m, uint8_t v){
+    // The header names are kept: hardware vertical mirroring is MIRROR_HORIZONTAL
+    static const enum mirror_type mirroring[4] = { ONE_LOWER_SCREEN, ONE_SCREEN_HIGHER, MIRROR_HORIZONTAL, MIRROR_VERTICAL };
+    m -> control = v;
+    mapper_set_mirroring(&m -> base, mirroring[v & 3]);
+    mmc1_remap_prg(m);
+    mmc1_remap_chr(m);
+}
+
+static void mmc1_write(mapper base, uint16_t addr, uint8_t v){
+    mmc1 m = (mmc1)base;
+
+    if (v & 0x80) {
+        m -> shift = 0;
+        m -> shift_count = 0;
+        mmc1_write_control(m, m -> control | 0x0C);
+        return;
+    }
+
+    m -> shift |= (v & 1) << m -> shift_count;
+    if (++m -> shift_count < 5) return;
+
+    switch ((addr >> 13) & 3) {
+        case 0:
+            mmc1_write_control(m, m -> shift);
+            break;
+        case 1:
+            m -> chr_bank0 = m -> shift;
+            mmc1_remap_chr(m);
+            mmc1_remap_prg(m);
+            break;
+        case 2:
+            m -> chr_bank1 = m -> shift;
+            mmc1_remap_chr(m);
+            break;
+        case 3:
+            m -> prg_bank = m -> shift;
+            mmc1_remap_prg(m);
+            break;
+    }
+    m -> shift = 0;
+    m -> shift_count = 0;
+}
+
+mapper mapper_mmc1_create(cartridge cart){
+    mmc1 m = (mmc1)mapper_alloc(sizeof(struct mapper_mmc1), cart, SxROM);
+    m -> base.cpu_write = mmc1_write;
+
+    // Power up with the last bank fixed at 0xC000
+    m -> control = 0x0C;
+    mmc1_remap_prg(m);
+    mmc1_remap_chr(m);
+    return &m -> base;
+}
@@ -0,0 +1,96 @@
+#include "headers/mapper_mmc3.h"
+
+static void mmc3_remap(mmc3 m){
+    uint32_t last = m -> base.prg_size / 0x2000 - 1;
+    uint16_t swap = m -> bank_select & 0x40 ? 0xC000 : 0x8000;
+    mapper_select_prg(&m -> base, swap, m -> banks[6], 0x2000);
+    mapper_select_prg(&m -> base, 0xA000, m -> banks[7], 0x2000);
+    mapper_select_prg(&m -> base, swap ^ 0x4000, last - 1, 0x2000);
+    mapper_select_prg(&m -> base, 0xE000, last, 0x2000);
+
+    uint16_t invert = m -> bank_select & 0x80 ? 0x1000 : 0;
+    mapper_select_chr(&m -> base, 0x0000 ^ invert, m -> banks[0] >> 1, 0x800);
+    mapper_select_chr(&m -> base, 0x0800 ^ invert, m -> banks[1] >> 1, 0x800);
+    for (int i = 0; i < 4; ++i) mapper_select_chr(&m -> base, (0x1000 + i * 0x400) ^ invert, m -> banks[2 + i], 0x400);
+}
+
+// The counter goes from latch down to 0 one line clock at a time, then reloads on the next clock
+// (or right away after a 0xC001 write), and the IRQ fires on every clock that leaves it at 0
+static int next_counter(mmc3 m){
+    return m -> irq_counter == 0 || m -> irq_reload ? m -> irq_latch : m -> irq_counter - 1;
+}
+
+static int mmc3_irq_clocks(mapper base, int64_t line_clocks){
+    mmc3 m = (mmc3)base;
+    int64_t clocks = line_clocks - m -> line_clocks;
+    m -> line_clocks = line_clocks;
+
+    if (clocks > 0) {
+        int next = next_counter(m);
+        if (clocks > next && m -> irq_enabled) m -> irq -> pull(m -> irq);
+
+        m -> irq_reload = false;
+        if (--clocks <= next) {
+            m -> irq_counter = next - clocks;
+        } else {
+            clocks -= next + 1;
+            m -> irq_counter = m -> irq_latch - clocks % (m -> irq_latch + 1);
+        }
+    }
+
+    return m -> irq_enabled ? next_counter(m) + 1 : 0;
+}
+
+// Bus sync has already brought the PPU up to date when a register is written
+static void mmc3_write(mapper base, uint16_t addr, uint8_t v){
+    mmc3 m = (mmc3)base;
+
+    // The counter only catches up when asked, it must be before its registers change
+    if (addr >= 0xC000 && m -> base.line_clocks) mmc3_irq_clocks(base, *m -> base.line_clocks);
+
+    switch (addr & 0xE001) {
+        case 0x8000:
+            m -> bank_select = v;
+            mmc3_remap(m);
+            return;
+        case 0x8001:
+            m -> banks[m -> bank_select & 7] = v;
+            mmc3_remap(m);
+            return;
+        case 0xA000:
+            // The header names are kept: hardware vertical mirroring is MIRROR_HORIZONTAL
+            if (m -> base.cart -> header.mirroring != FOUR_SCREEN)
+                mapper_set_mirroring(&m -> base, v & 1 ? MIRROR_VERTICAL : MIRROR_HORIZONTAL);
+            return;
+        case 0xA001:
+            // PRG-RAM protection, the RAM is always enabled
+            return;
+        case 0xC000:
+            m -> irq_latch = v;
+            break;
+        case 0xC001:
+            m -> irq_counter = 0;
+            m -> irq_reload = true;
+            break;
+        case 0xE000:
+            m -> irq_enabled = false;
+            m -> irq -> release(m -> irq);
+            break;
+        case 0xE001:
+            m -> irq_enabled = true;
+            break;
+    }
+    if (m -> base.irq_callback) m -> base.irq_callback(m -> base.irq_owner);
+}
+
+mapper mapper_mmc3_create(cartridge cart, irq_handle irq){
+    mmc3 m = (mmc3)mapper_alloc(sizeof(struct mapper_mmc3), cart, MMC3);
+    m -> base.cpu_write = mmc3_write;
+    m -> base.irq_clocks = mmc3_irq_clocks;
+    m -> irq = irq;
+
+    static const uint8_t banks[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+    memcpy(m -> banks, banks, sizeof(banks));
+    mmc3_remap(m);
+    return &m -> base;
+}
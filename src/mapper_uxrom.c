@@ -0,0 +1,14 @@
+#include "headers/mapper_uxrom.h"
+
+// 16 KiB switchable at 0x8000, the last bank fixed at 0xC000, CHR-RAM
+static void uxrom_write(mapper m, uint16_t addr, uint8_t v){
+    (void)addr;
+    mapper_select_prg(m, 0x8000, v, 0x4000);
+}
+
+mapper mapper_uxrom_create(cartridge cart){
+    mapper m = mapper_alloc(sizeof(struct Mapper), cart, UxROM);
+    m -> cpu_write = uxrom_write;
+    mapper_select_prg(m, 0xC000, m -> prg_size / 0x4000 - 1, 0x4000);
+    return m;
+}
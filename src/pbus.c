@@ -6,10 +6,13 @@
 
 pbus pbus_init(pbus pb){
     pb -> mapper = NULL;
+    // CIRAM, and the extra 2 KiB four screen cartridges carry right after it
     pb -> RAM_size = 0x800;
-    pb -> ram = (uint8_t*)calloc(pb -> RAM_size, sizeof(uint8_t));
+    pb -> ram = (uint8_t*)calloc(2 * pb -> RAM_size, sizeof(uint8_t));
     pb -> palette_size = 0x20;
     pb -> palette = (uint8_t*)calloc(pb -> palette_size, sizeof(uint8_t));
+    pb -> palette_callback = NULL;
+    pb -> palette_owner = NULL;
 }
 
 void pbus_destroy(pbus pb) {
@@ -17,44 +20,27 @@ void pbus_destroy(pbus pb) {
     free(pb -> ram);
 }
 
-uint8_t pbread(pbus p, uint16_t addr){
-    addr = addr & 0x3FFF;
-    if(addr < 0x2000) return p -> mapper -> chr_read(p -> mapper, addr);
-    else if(addr <= 0x3EFF){
-        const uint8_t index = addr & 0x3FF;
-        uint16_t normalised_addr = (addr >= 0x3000) ? addr - 0x1000 : addr;
-
-        if(p -> nametable0 >= p -> RAM_size) return p -> mapper -> chr_read(p -> mapper, normalised_addr);
-        else if(normalised_addr < 0x2400) return p -> ram[p -> nametable0 + index];
-        else if(normalised_addr < 0x2800) return p -> ram[p -> nametable1 + index];
-        else if(normalised_addr < 0x2C00) return p -> ram[p -> nametable2 + index];
-        else return p -> ram[p -> nametable3 + index];
-    } else if (addr <= 0x3FFF){
-        uint16_t palette_addr = addr & 0x1F;
-        return read_palette(p, palette_addr);
-    }
-    return 0x00;
-}
-
 void pbwrite(pbus p, uint16_t addr, uint8_t value){
     addr = addr & 0x3FFF;
-    if(addr < 0x2000) p -> mapper -> chr_write(p -> mapper, addr, value);
-    else if(addr <= 0x3EFF){
-        const uint8_t index = addr & 0x3FF;
-        uint16_t normalised_addr = (addr >= 0x3000) ? addr - 0x1000 : addr;
-
-        if(p -> nametable0 >= p -> RAM_size) p -> mapper -> chr_write(p -> mapper, normalised_addr, value);
-        else if(normalised_addr < 0x2400) p -> ram[p -> nametable0 + index] = value;
-        else if(normalised_addr < 0x2800) p -> ram[p -> nametable1 + index] = value;
-        else if(normalised_addr < 0x2C00) p -> ram[p -> nametable2 + index] = value;
-        else p -> ram[p -> nametable3 + index] = value;
-    } else if (addr <= 0x3FFF){
+    if(addr >= 0x3F00){
         uint16_t palette_addr = addr & 0x1F;
         if (palette_addr >= 0x10 && palette_addr % 4 == 0) palette_addr &= 0xF;
         p -> palette[palette_addr]  = value;
+        if(p -> palette_callback) p -> palette_callback(p -> palette_owner, palette_addr);
+    } else if(p -> write_slot[addr >> 10]){
+        uint8_t* byte = p -> write_slot[addr >> 10] + (addr & 0x3FF);
+        *byte = value;
+        // Pattern tables are CHR-RAM here, the decoded tiles follow it
+        if(addr < 0x2000) mapper_decode_chr(p -> mapper, byte - p -> mapper -> chr);
+    } else {
+        perror("Read-only CHR memory write to attempt at 0x%04X to set %d", addr, value);
     }
 }
 
+static void mirroring_changed(void* owner){
+    update_mirroring((pbus)owner);
+}
+
 bool set_mapper(pbus p, mapper m){
     if(!m){
         perror("Mapper is NULL");
@@ -62,40 +48,51 @@ bool set_mapper(pbus p, mapper m){
     }
 
     p -> mapper = m;
+    m -> chr_pages = p -> slot;
+    m -> chr_write_pages = p -> write_slot;
+    m -> chr_tile_pages = p -> tile_slot;
+    m -> map_chr(m);
+    set_mirroring_callback(m, mirroring_changed, p);
     update_mirroring(p);
     return true;
 }
 
+void set_palette_callback(pbus p, void (*callback)(void* owner, uint8_t palette_addr), void* owner){
+    p -> palette_callback = callback;
+    p -> palette_owner = owner;
+}
+
 uint8_t read_palette(pbus p, uint16_t palette_addr){
     if (palette_addr >= 0x10 && palette_addr % 4 == 0) palette_addr &= 0xF;
     return p -> palette[palette_addr];
 }
 
+// Points slots 8-15 at the CIRAM pages of the four nametables
+static void map_nametables(pbus p, size_t nametable0, size_t nametable1, size_t nametable2, size_t nametable3){
+    const size_t nametables[4] = { nametable0, nametable1, nametable2, nametable3 };
+    for(int i = 0; i < 8; ++i) p -> slot[8 + i] = p -> write_slot[8 + i] = p -> ram + nametables[i & 3];
+}
+
 void update_mirroring(pbus p){
-    switch (p -> mapper -> get_mirror_type()) {
+    enum mirror_type type = p -> mapper -> mirroring;
+    switch (type) {
         case MIRROR_VERTICAL:
-            p -> nametable0 = p -> nametable1 = 0;
-            p -> nametable2 = p -> nametable3 = 0x400;
+            map_nametables(p, 0, 0, 0x400, 0x400);
             break;
         case MIRROR_HORIZONTAL:
-            p -> nametable0 = p -> nametable2 = 0;
-            p -> nametable1 = p -> nametable3 = 0x400;
+            map_nametables(p, 0, 0x400, 0, 0x400);
             break;
         case ONE_LOWER_SCREEN:
-            p -> nametable0 = p -> nametable1 = p -> nametable2 = p -> nametable3 = 0;
+            map_nametables(p, 0, 0, 0, 0);
             break;
         case ONE_SCREEN_HIGHER:
-            p -> nametable0 = p -> nametable1 = p -> nametable2 = p -> nametable3 = 0x400;
+            map_nametables(p, 0x400, 0x400, 0x400, 0x400);
             break;
         case FOUR_SCREEN:
-            p -> nametable0 = p -> RAM_size;
+            map_nametables(p, 0, 0x400, 0x800, 0xC00);
             break;
         default:
-            p -> nametable0 = p -> nametable1 = p -> nametable2 = p -> nametable3 = 0;
-            perror("Unsupported Name Table Mirroring -> %s", p -> mapper -> get_mirror_type());
+            map_nametables(p, 0, 0, 0, 0);
+            perror("Unsupported Name Table Mirroring -> %d", type);
     }
 }
-
-void scanline_IRQ(pbus p){
-    scanlineIRQ(p -> mapper);
-}
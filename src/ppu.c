@@ -3,64 +3,83 @@
 //
 
 #include "headers/ppu.h"
+#include "headers/bus.h"
 #include "headers/palette.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>   // memset
 
-void bv_init(bv v, size_t reserve_capacity) {
-    v -> data = calloc(reserve_capacity, sizeof(uint8_t));
-    v -> size = 0;
-    v -> capacity = reserve_capacity;
-}
-
-void bv_reserve(bv v, size_t new_cap) {
-    if (new_cap > v->capacity) {
-        v->data = realloc(v->data, new_cap * sizeof(uint8_t));
-        v->capacity = new_cap;
+// The 64 colours under each of the 8 emphasis combinations. An emphasis bit dims the other two channels
+static Color emphasis_colors[8][64];
+
+static void init_emphasis_colors(void){
+    for(int emphasis = 0; emphasis < 8; ++emphasis){
+        for(int i = 0; i < 64; ++i){
+            // colors[] is 0xRRGGBBAA
+            int r = (colors[i] >> 24) & 0xFF, g = (colors[i] >> 16) & 0xFF, b = (colors[i] >> 8) & 0xFF;
+            if(emphasis & 1){ g = g * 209 / 256; b = b * 209 / 256; }
+            if(emphasis & 2){ r = r * 209 / 256; b = b * 209 / 256; }
+            if(emphasis & 4){ r = r * 209 / 256; g = g * 209 / 256; }
+            emphasis_colors[emphasis][i] = (Color){ (unsigned char)r, (unsigned char)g, (unsigned char)b, 255 };
+        }
     }
 }
 
-void bv_resize(bv v, size_t new_size) {
-    if (new_size > v->capacity) {
-        v->data = realloc(v->data, new_size * sizeof(uint8_t));
-        v->capacity = new_size;
-    }
-    v->size = new_size;
+// Turns a row of NES colours into host ones. AVX2 looks 8 pixels up at once, picked by select_resolve_row
+static void (*resolve_row)(Color* pixels, const uint8_t* indices, const Color* colors, int width);
+
+static void resolve_row_scalar(Color* pixels, const uint8_t* indices, const Color* colors, int width){
+    for(int x = 0; x < width; ++x) pixels[x] = colors[indices[x] & 0x3F];
 }
 
-void bv_push(bv v, uint8_t value) {
-    if (v->size >= v->capacity) {
-        v->capacity = v->capacity ? v->capacity * 2 : 1;
-        v->data = realloc(v->data, v->capacity * sizeof(uint8_t));
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PPU_SIMD
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static void resolve_row_avx2(Color* pixels, const uint8_t* indices, const Color* colors, int width){
+    const __m256i mask = _mm256_set1_epi32(0x3F);
+    int x = 0;
+    for(; x + 8 <= width; x += 8){
+        __m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(indices + x))), mask);
+        _mm256_storeu_si256((__m256i*)(pixels + x), _mm256_i32gather_epi32((const int*)colors, index, 4));
     }
-    v->data[v->size++] = value;
+    resolve_row_scalar(pixels + x, indices + x, colors, width - x);
 }
-
-void bv_clear(bv v) {
-    v->size = 0;   // come resize(0)
+#endif
+
+static void select_resolve_row(void){
+    resolve_row = resolve_row_scalar;
+#ifdef PPU_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) resolve_row = resolve_row_avx2;
+#endif
 }
 
-void bv_free(bv v) {
-    free(v->data);
-    v->data = NULL;
-    v->size = v->capacity = 0;
+void PBResolve(PictureBuffer *pb){
+    for(int y = 0; y < pb->height; ++y)
+        resolve_row(pb->pixels + PB_INDEX(pb, 0, y), pb->indices + PB_INDEX(pb, 0, y),
+                    emphasis_colors[pb->emphasis[y] & 7], pb->width);
 }
 
-static inline void PBSet(PictureBuffer *pb, int x, int y, Color c) {
-    pb->pixels[PB_INDEX(pb, x, y)] = c;
+static inline void PBSet(PictureBuffer *pb, int x, int y, uint8_t index) {
+    pb->indices[PB_INDEX(pb, x, y)] = index;
 }
 
-static inline Color PBGet(const PictureBuffer *pb, int x, int y) {
-    return pb->pixels[PB_INDEX(pb, x, y)];
+static inline uint8_t PBGet(const PictureBuffer *pb, int x, int y) {
+    return pb->indices[PB_INDEX(pb, x, y)];
 }
 
 bool PBInit(PictureBuffer *pb, int width, int height, Color fill) {
     pb->width  = width;
     pb->height = height;
-    pb->pixels = (Color*)malloc(sizeof(Color) * (size_t)width * (size_t)height);
-    if (!pb->pixels) return false;
+    pb->pixels   = (Color*)malloc(sizeof(Color) * (size_t)width * (size_t)height);
+    pb->indices  = (uint8_t*)calloc((size_t)width * (size_t)height, 1);
+    pb->emphasis = (uint8_t*)calloc((size_t)height, 1);
+    if (!pb->pixels || !pb->indices || !pb->emphasis) return false;
+    init_emphasis_colors();
+    select_resolve_row();
 
     // riempi con un colore iniziale (es. MAGENTA)
     for (int i = 0; i < width*height; ++i) pb->pixels[i] = fill;
@@ -80,16 +99,21 @@ bool PBInit(PictureBuffer *pb, int width, int height, Color fill) {
 void PBFree(PictureBuffer *pb) {
     if (pb->tex.id) UnloadTexture(pb->tex);
     free(pb->pixels);
+    free(pb->indices);
+    free(pb->emphasis);
     pb->pixels = NULL;
+    pb->indices = pb->emphasis = NULL;
     pb->width = pb->height = 0;
 }
 
-void PBClear(PictureBuffer *pb, Color fill) {
-    for (int i = 0; i < pb->width * pb->height; ++i) pb->pixels[i] = fill;
+void PBClear(PictureBuffer *pb, uint8_t index) {
+    memset(pb->indices, index, (size_t)pb->width * (size_t)pb->height);
+    memset(pb->emphasis, 0, (size_t)pb->height);
 }
 
 // chiama questo dopo aver modificato i pixel per “spingere” sulla GPU
 void PBFlushToGPU(PictureBuffer *pb) {
+    PBResolve(pb);
     UpdateTexture(pb->tex, pb->pixels);
 }
 
@@ -101,178 +125,359 @@ void ppu_write(ppu pp, uint16_t addr, uint8_t v){
     pbwrite(pp -> bus, addr, v);
 }
 
-void create_ppu(ppu pp, pbus pb){
-    pp -> bus = pb;
-    bv_init(pp -> sprite_memory, (64 * 4));
-    bv_init(pp -> scanline_sprites, 0);
-    PBInit(pp -> picture_buffer, SCANLINE_VISIBLE_DOTS, VISIBLE_SCANLINE, MAGENTA);
+// Coarse X step at the end of every fetched tile, into the next horizontal nametable after 31
+static inline void increment_x(ppu pp){
+    if((pp -> data_address & 0x001F) == 31){
+        pp -> data_address &= ~0x001F;
+        pp -> data_address ^= 0x0400;
+    }else{
+        pp -> data_address += 1;
+    }
 }
 
-void step(ppu pp, cpu c){
-    switch (pp -> pipeline_state) {
-        case PRE_RENDER:
-            if(pp -> cycle == 1){
-                pp -> vblank = pp -> sprite_zero_hit = false;
-            }else if(pp -> cycle == SCANLINE_VISIBLE_DOTS + 2 && pp -> show_background && pp -> show_sprites){
-                pp->data_address &= ~0x41F;
-                pp->data_address |= pp->temp_address & 0x41F;
-            }else if(pp -> cycle > 280 && pp -> cycle <= 304 && pp -> show_background && pp -> show_sprites){
-                pp->data_address &= ~0x7BE0;
-                pp->data_address |= pp->temp_address & 0x7BE0;
-            }
+// Fine Y step at dot 256, into the next vertical nametable after row 29
+static inline void increment_y(ppu pp){
+    if((pp -> data_address & 0x7000) != 0x7000){
+        pp -> data_address += 0x1000;
+        return;
+    }
 
-            if(pp -> cycle >= SCANLINE_END_CYCLE - (!pp -> even_frame && pp -> show_background && pp -> show_sprites)){
-                pp -> pipeline_state = RENDER;
-                pp -> cycle = pp -> scanline = 0;
-            }
+    pp -> data_address &= ~0x7000;
+    int y = (pp -> data_address & 0x03E0) >> 5;
+    if(y == 29) {
+        y = 0;
+        pp -> data_address ^= 0x0800;
+    } else if(y == 31) y = 0;
+    else y += 1;
 
-            if(pp -> cycle >= 260 && pp -> show_background && pp -> show_sprites) scanline_IRQ(pp -> bus);
-            break;
-        case RENDER:
-            if(pp -> cycle > 0 && pp -> cycle <= SCANLINE_VISIBLE_DOTS){
-                uint8_t bg_color = 0, spr_color = 0;
-                bool bg_opaque = false, spr_opaque = true;
-                bool sprite_fg = false;
+    pp -> data_address = ((pp -> data_address & ~0x03E0) | (y << 5));
+}
 
-                int x = pp -> cycle - 1;
-                int y = pp -> scanline;
+// Palette bits of the tile at data_address, out of its attribute byte
+static inline uint8_t fetch_attribute(ppu pp){
+    uint16_t addr = 0x23C0 | (pp -> data_address & 0x0C00) | ((pp -> data_address >> 4) & 0x38) | ((pp -> data_address >> 2) & 0x07);
+    return (ppu_read(pp, addr) >> (((pp -> data_address >> 4) & 4) | (pp -> data_address & 2))) & 0x3;
+}
 
-                if(pp -> show_background){
-                    uint8_t x_fine = (pp -> fine_x_scroll + x) % 8;
-                    if(!pp -> hide_edge_backgound || x >= 8){
-                        uint16_t addr = 0x2000 | (pp -> data_address & 0x0FFF);
-                        uint8_t tile = ppu_read(pp, addr);
+// Low plane of the background tile row at fine Y, the high plane is 8 bytes after it
+static inline uint16_t pattern_address(ppu pp, uint8_t tile){
+    return (pp -> bg_page << 12) + tile * 16 + ((pp -> data_address >> 12) & 0x7);
+}
 
-                        addr = (tile * 16) + ((pp -> data_address >> 12) & 0x7);
-                        addr |= pp -> bg_page << 12;
+// Puts the tile fetched in the last 8 dots in the low byte of the shift registers
+static inline void load_background_shifters(ppu pp){
+    pp -> bg_shift_low            = (pp -> bg_shift_low  & 0xFF00) | pp -> bg_next_low;
+    pp -> bg_shift_high           = (pp -> bg_shift_high & 0xFF00) | pp -> bg_next_high;
+    pp -> bg_shift_attribute_low  = (pp -> bg_shift_attribute_low  & 0xFF00) | ((pp -> bg_next_attribute & 1) ? 0xFF : 0x00);
+    pp -> bg_shift_attribute_high = (pp -> bg_shift_attribute_high & 0xFF00) | ((pp -> bg_next_attribute & 2) ? 0xFF : 0x00);
+}
 
-                        bg_color = (ppu_read(pp, addr) >> (7 ^ x_fine)) & 1;
-                        bg_color = ((ppu_read(pp, addr + 8) >> (7 ^ x_fine)) & 1) << 1;
+// Background fetches and VRAM address updates of the visible and pre-render lines, with rendering on.
+// Dots 1-256 fetch the rest of the line, 321-336 the first two tiles of the next one.
+static inline void background_pipeline(ppu pp){
+    int cycle = pp -> cycle;
+
+    if((cycle >= 1 && cycle <= SCANLINE_VISIBLE_DOTS) || (cycle >= 321 && cycle <= 336)){
+        pp -> bg_shift_low            <<= 1;
+        pp -> bg_shift_high           <<= 1;
+        pp -> bg_shift_attribute_low  <<= 1;
+        pp -> bg_shift_attribute_high <<= 1;
+
+        switch((cycle - 1) & 7){
+            case 0:
+                pp -> bg_next_tile = ppu_read(pp, 0x2000 | (pp -> data_address & 0x0FFF));
+                break;
+            case 2:
+                pp -> bg_next_attribute = fetch_attribute(pp);
+                break;
+            case 4:
+                pp -> bg_next_low = ppu_read(pp, pattern_address(pp, pp -> bg_next_tile));
+                break;
+            case 6:
+                pp -> bg_next_high = ppu_read(pp, pattern_address(pp, pp -> bg_next_tile) + 8);
+                break;
+            case 7:
+                load_background_shifters(pp);
+                increment_x(pp);
+                break;
+        }
+    }
 
-                        bg_opaque = bg_color;
+    if(cycle == SCANLINE_VISIBLE_DOTS){
+        increment_y(pp);
+    }else if(cycle == SCANLINE_VISIBLE_DOTS + 1){
+        pp -> data_address &= ~0x41F;
+        pp -> data_address |= pp -> temp_address & 0x41F;
+    }else if(pp -> pipeline_state == PRE_RENDER && cycle >= 280 && cycle <= 304){
+        pp -> data_address &= ~0x7BE0;
+        pp -> data_address |= pp -> temp_address & 0x7BE0;
+    }
+}
 
-                        addr = 0x23C0 | (pp -> data_address & 0x0C00) | ((pp -> data_address >> 4) & 0x38) | ((pp -> data_address >> 2) & 0x07);
-                        uint8_t attribute = ppu_read(pp, addr);
-                        int shift = ((pp -> data_address >> 4) & 4) | (pp -> data_address & 2);
+// Pixel of the background at the current dot, palette bits included, read at fine X from the shift registers
+static inline uint8_t background_pixel(ppu pp){
+    uint16_t bit = 0x8000 >> pp -> fine_x_scroll;
+    return (!!(pp -> bg_shift_low & bit))
+         | (!!(pp -> bg_shift_high & bit) << 1)
+         | (!!(pp -> bg_shift_attribute_low & bit) << 2)
+         | (!!(pp -> bg_shift_attribute_high & bit) << 3);
+}
 
-                        bg_color |= ((attribute >> shift) & 0x3) << 2;
-                    }
+// Bit i set when OAM entry i covers the line, with its top row at Y + 1. All 64 entries are compared
+// at once where the host has SIMD, sprites_on_line is picked at create_ppu
+static uint64_t (*sprites_on_line)(const uint8_t* oam, uint8_t line, uint8_t range);
 
-                    if(x_fine == 7){
-                        if((pp -> data_address & 0x001F) == 31){
-                            pp -> data_address &= ~0x001F;
-                            pp -> data_address ^= 0x0400;
-                        }else{
-                            pp -> data_address += 1;
-                        }
-                    }
-                }
+static uint64_t sprites_on_line_scalar(const uint8_t* oam, uint8_t line, uint8_t range){
+    uint64_t hits = 0;
+    for(int i = 0; i < 64; ++i){
+        int row = line - oam[i * 4];
+        if(row >= 0 && row < range) hits |= 1ull << i;
+    }
+    return hits;
+}
 
-                if(pp -> show_sprites && (pp -> hide_edge_sprites || x >= 8)){
-                    for(int i = 0; i < pp -> scanline_sprites -> size; i++){
-                        uint8_t spr_x = pp -> sprite_memory -> data[i * 4 + 2];
+#ifdef PPU_SIMD
+// The Y bytes of 16 entries are packed together, then line - Y (0 when Y is below) is checked against range
+__attribute__((target("sse2")))
+static uint64_t sprites_on_line_sse2(const uint8_t* oam, uint8_t line, uint8_t range){
+    const __m128i low   = _mm_set1_epi32(0xFF);
+    const __m128i lines = _mm_set1_epi8((char)line);
+    const __m128i last  = _mm_set1_epi8((char)(range - 1));
+    uint64_t hits = 0;
+
+    for(int i = 0; i < 4; ++i){
+        const __m128i* entries = (const __m128i*)(oam + i * 64);
+        __m128i a = _mm_and_si128(_mm_loadu_si128(entries + 0), low);
+        __m128i b = _mm_and_si128(_mm_loadu_si128(entries + 1), low);
+        __m128i c = _mm_and_si128(_mm_loadu_si128(entries + 2), low);
+        __m128i d = _mm_and_si128(_mm_loadu_si128(entries + 3), low);
+        __m128i y = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+
+        __m128i rows  = _mm_subs_epu8(lines, y);
+        __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(y, lines), lines);
+        __m128i in    = _mm_and_si128(above, _mm_cmpeq_epi8(_mm_min_epu8(rows, last), rows));
+        hits |= (uint64_t)(uint16_t)_mm_movemask_epi8(in) << (i * 16);
+    }
+    return hits;
+}
 
-                        if (0 > x - spr_x || x - spr_x >= 8) continue;
+// Same with 32 entries at a time, the packs work per 128 bit lane so the 4 byte groups are put back in order
+__attribute__((target("avx2")))
+static uint64_t sprites_on_line_avx2(const uint8_t* oam, uint8_t line, uint8_t range){
+    const __m256i low   = _mm256_set1_epi32(0xFF);
+    const __m256i lines = _mm256_set1_epi8((char)line);
+    const __m256i last  = _mm256_set1_epi8((char)(range - 1));
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    uint64_t hits = 0;
+
+    for(int i = 0; i < 2; ++i){
+        const __m256i* entries = (const __m256i*)(oam + i * 128);
+        __m256i a = _mm256_and_si256(_mm256_loadu_si256(entries + 0), low);
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256(entries + 1), low);
+        __m256i c = _mm256_and_si256(_mm256_loadu_si256(entries + 2), low);
+        __m256i d = _mm256_and_si256(_mm256_loadu_si256(entries + 3), low);
+        __m256i y = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        y = _mm256_permutevar8x32_epi32(y, order);
+
+        __m256i rows  = _mm256_subs_epu8(lines, y);
+        __m256i above = _mm256_cmpeq_epi8(_mm256_max_epu8(y, lines), lines);
+        __m256i in    = _mm256_and_si256(above, _mm256_cmpeq_epi8(_mm256_min_epu8(rows, last), rows));
+        hits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(in) << (i * 32);
+    }
+    return hits;
+}
+#endif
+
+static void select_sprites_on_line(void){
+    sprites_on_line = sprites_on_line_scalar;
+#ifdef PPU_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))      sprites_on_line = sprites_on_line_avx2;
+    else if(__builtin_cpu_supports("sse2")) sprites_on_line = sprites_on_line_sse2;
+#endif
+}
 
-                        uint8_t spr_y = pp -> sprite_memory -> data[i * 4 + 0] + 1,
-                                tile = pp -> sprite_memory -> data[i * 4 + 1],
-                                attribute = pp -> sprite_memory -> data[i * 4 + 2];
+// Copies the sprites of the next line to secondary_oam, in OAM order: the first 8 entries from sprite_data_address
+// on that cover it, a 9th one sets the overflow flag. line_sprite_zero tells whether the first is the one evaluated first
+static void evaluate_sprites(ppu pp){
+    int first = pp -> sprite_data_address / 4;
+    uint64_t hits = sprites_on_line(pp -> sprite_memory, pp -> scanline, pp -> long_sprite ? 16 : 8) & (~0ull << first);
+
+    pp -> line_sprite_zero = (hits >> first) & 1;
+    pp -> secondary_count = 0;
+    while(hits && pp -> secondary_count < 8){
+        memcpy(pp -> secondary_oam + pp -> secondary_count++ * 4, pp -> sprite_memory + __builtin_ctzll(hits) * 4, 4);
+        hits &= hits - 1;
+    }
+    if(hits) pp -> sprite_overflow = true;
+}
 
-                        int length = (pp -> long_sprite) ? 16 : 8;
+// Sprite fetches of dots 257 - 320: the sprites evaluated for the next line are drawn into sprite_line,
+// the last ones first so the first opaque sprite in OAM order is the one left on every pixel
+static void fetch_sprites(ppu pp){
+    memset(pp -> sprite_line, 0, sizeof(pp -> sprite_line));
+
+    int length = pp -> long_sprite ? 16 : 8;
+    for(int i = pp -> secondary_count - 1; i >= 0; --i){
+        const uint8_t* sprite = pp -> secondary_oam + i * 4;
+        uint8_t tile = sprite[1], attribute = sprite[2], spr_x = sprite[3];
+
+        // Y is the line above the top row
+        int row = (uint8_t)(pp -> scanline - sprite[0]);
+        if(attribute & 0x80) row ^= length - 1;
+
+        uint16_t addr;
+        if(pp -> long_sprite){
+            addr = ((tile & 1) << 12) | ((tile >> 1) * 32) | ((row & 8) << 1) | (row & 7);
+        }else{
+            addr = (pp -> spr_page << 12) | (tile * 16) | row;
+        }
+
+        // Horizontal flips come decoded
+        uint64_t pixels = pbus_tile_row(pp -> bus, addr, attribute & 0x40);
+        uint8_t flags = 0x10 | ((attribute & 0x3) << 2) | ((attribute & 0x20) ? SPRITE_BEHIND : 0)
+                      | ((i == 0 && pp -> line_sprite_zero) ? SPRITE_ZERO : 0);
+
+        for(int column = 0; column < 8 && spr_x + column < SCANLINE_VISIBLE_DOTS; ++column){
+            uint8_t color = (pixels >> (column * 8)) & 0x3;
+            if(color) pp -> sprite_line[spr_x + column] = flags | color;
+        }
+    }
+}
 
-                        int x_shift = (x - spr_x) % 8, y_offset = (y - spr_y) % length;
+// Dot 257 of the visible and pre-render lines. Sprites never show on line 0
+static void load_sprites(ppu pp){
+    if(pp -> pipeline_state == RENDER && (pp -> show_background || pp -> show_sprites)){
+        evaluate_sprites(pp);
+        fetch_sprites(pp);
+    }else{
+        memset(pp -> sprite_line, 0, sizeof(pp -> sprite_line));
+    }
+}
 
-                        if ((attribute & 0x40) == 0) // If NOT flipping horizontally
-                            x_shift ^= 7;
-                        if ((attribute & 0x80) != 0) // IF flipping vertically
-                            y_offset ^= (length - 1);
+// NES colour of the dot at x of the current line, background is the pipeline pixel for it
+static inline uint8_t pixel_index(ppu pp, int x, uint8_t background){
+    uint8_t bg_color = 0, sprite = 0;
 
-                        uint16_t addr = 0;
+    if(pp -> show_background && (!pp -> hide_edge_backgound || x >= 8)) bg_color = background;
+    if(pp -> show_sprites && (!pp -> hide_edge_sprites || x >= 8)) sprite = pp -> sprite_line[x];
 
-                        if(pp -> long_sprite){
-                            addr = tile * 16 + y_offset;
-                            if(pp -> spr_page == HIGH) addr += 0x1000;
-                        }else{
-                            y_offset = (y_offset & 7) | ((y_offset & 8) << 1);
-                            addr = (tile >> 1) * 32 + y_offset;
-                            addr |= (tile & 1) << 12;
-                        }
+    bool bg_opaque = bg_color & 0x3;
+    uint8_t palette_addr = bg_opaque ? bg_color : 0;
 
-                        spr_color |= (ppu_read(pp, addr) >> (x_shift)) & 1;
-                        spr_color |= ((ppu_read(pp, addr + 8) >> (x_shift)) & 1) << 1;
+    if(sprite){
+        if(!pp -> sprite_zero_hit && (sprite & SPRITE_ZERO) && bg_opaque) pp -> sprite_zero_hit = true;
+        if(!bg_opaque || !(sprite & SPRITE_BEHIND)) palette_addr = sprite & 0x1F;
+    }
 
-                        if(!(spr_opaque = spr_color)){
-                            spr_color = 0;
-                            continue;
-                        }
+    return pp -> palette_indices[palette_addr];
+}
 
-                        spr_color |= 0x10;
-                        spr_color |= (attribute & 0x3) << 2;
+// Last dot of a visible line
+static void end_visible_line(ppu pp){
+    ++pp -> scanline;
+    pp -> cycle = 0;
+    if(pp -> scanline >= VISIBLE_SCANLINE) pp -> pipeline_state = POST_RENDER;
+}
 
-                        sprite_fg  = !(attribute & 0x20);
+static void resolve_palette(ppu pp, uint8_t palette_addr){
+    pp -> palette_indices[palette_addr] = read_palette(pp -> bus, palette_addr) & (pp -> grayscale_mode ? 0x30 : 0x3F);
+}
 
-                        if(!pp -> sprite_zero_hit && pp -> show_background && i == 0 && spr_opaque && bg_opaque) pp -> sprite_zero_hit = true;
+static void resolve_palettes(ppu pp){
+    for(uint8_t palette_addr = 0; palette_addr < 32; ++palette_addr) resolve_palette(pp, palette_addr);
+}
 
-                        break;
-                    }
-                }
+static void palette_written(void* owner, uint8_t palette_addr){
+    ppu pp = (ppu)owner;
+    resolve_palette(pp, palette_addr);
+    // 0x00, 0x04, 0x08, 0x0C are also read as 0x10, 0x14, 0x18, 0x1C
+    if(!(palette_addr & 3)) resolve_palette(pp, palette_addr ^ 0x10);
+}
 
-                uint8_t palette_addr = bg_color;
-
-                if ((!bg_opaque && spr_opaque) || (bg_opaque && spr_opaque && sprite_fg))
-                    palette_addr = spr_color;
-                else if (!bg_opaque && !spr_opaque)
-                    palette_addr = 0;
-
-                uint32_t col = colors[read_palette(pp->bus, palette_addr)];
-                Color c = {
-                        (unsigned char)((col >> 16) & 0xFF),  // R
-                        (unsigned char)((col >> 8)  & 0xFF),  // G
-                        (unsigned char)(col & 0xFF),          // B
-                        255                                   // A = fully opaque
-                };
-                PBSet(pp->picture_buffer, x, y, c);
-            }else if(pp -> cycle == SCANLINE_VISIBLE_DOTS + 1 && pp -> show_background){
-                if((pp -> data_address & 0x7000) != 0x7000) pp -> data_address += 0x1000;
-                else{
-                    pp -> data_address &= ~0x7000;
-                    int y = (pp -> data_address & 0x03E0) >> 5;
-                    if(y == 29) {
-                        y = 0;
-                        pp -> data_address ^= 0x8000;
-                    } else if(y == 31) y = 0;
-                    else y += 1;
-
-                    pp -> data_address = ((pp -> data_address & ~0x03E0) | (y << 5));
-                }
-            }else if(pp -> cycle == SCANLINE_VISIBLE_DOTS + 2 && pp -> show_background && pp -> show_sprites){
-                pp -> data_address &= ~0x41f;
-                pp -> data_address |= pp -> temp_address & 0x41f;
-            }
+// A whole visible line in one call, for lines no register access falls within.
+// Fetches what the pipeline does and leaves the PPU as the step calls from dot 1 to the end would.
+static void render_line(ppu pp){
+    // Background of the 34 tiles the line goes through, palette bits included
+    uint8_t row[SCANLINE_VISIBLE_DOTS + 16];
+    bool rendering = pp -> show_background || pp -> show_sprites;
+    pp -> picture_buffer -> emphasis[pp -> scanline] = pp -> emphasis;
+
+    if(rendering){
+        // The first two tiles are already in the shift registers
+        for(int i = 0; i < 16; ++i){
+            uint16_t bit = 0x8000 >> i;
+            row[i] = (!!(pp -> bg_shift_low & bit))
+                   | (!!(pp -> bg_shift_high & bit) << 1)
+                   | (!!(pp -> bg_shift_attribute_low & bit) << 2)
+                   | (!!(pp -> bg_shift_attribute_high & bit) << 3);
+        }
+        for(int tile = 2; tile < 34; ++tile){
+            uint8_t  index     = ppu_read(pp, 0x2000 | (pp -> data_address & 0x0FFF));
+            uint8_t  attribute = fetch_attribute(pp);
+            uint64_t pixels    = pbus_tile_row(pp -> bus, pattern_address(pp, index), false) | attribute * 0x0404040404040404ull;
+            memcpy(row + tile * 8, &pixels, sizeof(pixels));
+            increment_x(pp);
+        }
+    }else{
+        memset(row, 0, sizeof(row));
+    }
 
-            if(pp -> cycle == 260 && pp -> show_background && pp -> show_sprites) scanline_IRQ(pp -> bus);
-            if(pp -> cycle >= SCANLINE_END_CYCLE) {
-                bv_resize(pp -> scanline_sprites, 0);
-
-                int range = pp -> long_sprite ? 16 : 8;
-                size_t j = 0;
-                for(size_t i = pp -> sprite_data_address / 4; i < 64; i++){
-                    uint16_t diff = (pp -> scanline - pp -> sprite_memory -> data[i * 4]);
-                    if(0 <= diff && diff < range){
-                        if(j >= 8){
-                            pp -> sprite_overflow = true;
-                            break;
-                        }
-                        bv_push(pp -> scanline_sprites, i);
-                        ++j;
-                    }
-                }
+    // Built here and copied once, byte stores to the picture buffer could be to the PPU as far as the compiler knows
+    uint8_t line[SCANLINE_VISIBLE_DOTS];
+    for(int x = 0; x < SCANLINE_VISIBLE_DOTS; ++x) line[x] = pixel_index(pp, x, row[x + pp -> fine_x_scroll]);
+    memcpy(pp -> picture_buffer -> indices + PB_INDEX(pp -> picture_buffer, 0, pp -> scanline), line, sizeof(line));
 
-                ++pp -> scanline;
-                pp -> cycle = 0;
+    if(rendering){
+        increment_y(pp);
+        pp -> cycle = SCANLINE_VISIBLE_DOTS + 1;
+        background_pipeline(pp);
+    }
+    load_sprites(pp);
+    if(pp -> show_background && pp -> show_sprites) ++pp -> line_clocks;
+    if(rendering){
+        for(pp -> cycle = 321; pp -> cycle <= 336; ++pp -> cycle) background_pipeline(pp);
+    }
+
+    end_visible_line(pp);
+    ++pp -> cycle;
+}
+
+void create_ppu(ppu pp, pbus pb){
+    pp -> bus = pb;
+    select_sprites_on_line();
+    set_palette_callback(pb, palette_written, pp);
+    memset(pp -> sprite_memory, 0, sizeof(pp -> sprite_memory));
+    PBInit(pp -> picture_buffer, SCANLINE_VISIBLE_DOTS, VISIBLE_SCANLINE, MAGENTA);
+    pp -> rendering_callback = NULL;
+    pp -> rendering_owner = NULL;
+}
+
+void step(ppu pp, cpu c){
+    switch (pp -> pipeline_state) {
+        case PRE_RENDER:
+            if(pp -> cycle == 1){
+                pp -> vblank = pp -> sprite_zero_hit = false;
             }
+            if(pp -> show_background || pp -> show_sprites) background_pipeline(pp);
+            if(pp -> cycle == SCANLINE_VISIBLE_DOTS + 1) load_sprites(pp);
 
-            if(pp -> scanline >= VISIBLE_SCANLINE) pp -> pipeline_state = POST_RENDER;
+            if(pp -> cycle >= SCANLINE_END_CYCLE - (!pp -> even_frame && pp -> show_background && pp -> show_sprites)){
+                pp -> pipeline_state = RENDER;
+                pp -> cycle = pp -> scanline = 0;
+            }
+
+            if(pp -> cycle == 260 && pp -> show_background && pp -> show_sprites) ++pp -> line_clocks;
+            break;
+        case RENDER:
+            if(pp -> cycle == 1) pp -> picture_buffer -> emphasis[pp -> scanline] = pp -> emphasis;
+            if(pp -> cycle > 0 && pp -> cycle <= SCANLINE_VISIBLE_DOTS)
+                PBSet(pp -> picture_buffer, pp -> cycle - 1, pp -> scanline, pixel_index(pp, pp -> cycle - 1, background_pixel(pp)));
+            if(pp -> show_background || pp -> show_sprites) background_pipeline(pp);
+            if(pp -> cycle == SCANLINE_VISIBLE_DOTS + 1) load_sprites(pp);
+
+            if(pp -> cycle == 260 && pp -> show_background && pp -> show_sprites) ++pp -> line_clocks;
+            if(pp -> cycle >= SCANLINE_END_CYCLE) end_visible_line(pp);
             break;
         case POST_RENDER:
             if(pp -> cycle == SCANLINE_END_CYCLE){
@@ -309,6 +514,73 @@ void step(ppu pp, cpu c){
             perror("Logic error in PPU step");
             exit(EXIT_FAILURE);
     }
+
+    ++pp -> cycle;
+}
+
+void ppu_run(ppu pp, cpu c, int64_t dots){
+    while(dots > 0){
+        int to_line_end = SCANLINE_END_CYCLE - pp -> cycle + 1;
+        bool idle_line = pp -> pipeline_state == POST_RENDER
+                      || (pp -> pipeline_state == VERTICAL_BLANK && (pp -> scanline != VISIBLE_SCANLINE + 1 || pp -> cycle > 1));
+
+        if(pp -> pipeline_state == RENDER && pp -> cycle == 1 && dots >= to_line_end){
+            render_line(pp);
+            dots -= to_line_end;
+        }else if(idle_line && dots >= to_line_end){
+            // Nothing happens on these lines before their last dot
+            pp -> cycle = SCANLINE_END_CYCLE;
+            step(pp, c);
+            dots -= to_line_end;
+        }else{
+            step(pp, c);
+            --dots;
+        }
+    }
+}
+
+int ppu_dots_until_vblank(ppu pp){
+    // Every line after the first one runs from cycle 1 to SCANLINE_END_CYCLE.
+    // The odd frame skip is always assumed, so the prediction is never late.
+    const int line = SCANLINE_END_CYCLE;
+    int to_line_end = SCANLINE_END_CYCLE - pp -> cycle + 1;
+
+    switch (pp -> pipeline_state) {
+        case PRE_RENDER:
+            return to_line_end - !pp -> even_frame + VISIBLE_SCANLINE * line + line + 1;
+        case RENDER:
+            return to_line_end + (VISIBLE_SCANLINE - 1 - pp -> scanline) * line + line + 1;
+        case POST_RENDER:
+            return to_line_end + 1;
+        case VERTICAL_BLANK:
+        default:
+            if(pp -> scanline == VISIBLE_SCANLINE + 1 && pp -> cycle <= 1) return 1;
+            return to_line_end + (FRAME_END_SCANLINE - 1 - pp -> scanline) * line
+                   + line - pp -> even_frame + VISIBLE_SCANLINE * line + line + 1;
+    }
+}
+
+int ppu_dots_until_line_clock(ppu pp, int clocks){
+    if(!(pp -> show_background && pp -> show_sprites)) return -1;
+
+    // Lines are counted from the pre-render one (0) to the last of vertical blank (261): the first 241
+    // clock at cycle 260. Like step, every line runs from cycle 1 to SCANLINE_END_CYCLE and the
+    // pre-render line of odd frames ends one dot early
+    const int line = SCANLINE_END_CYCLE, frame_lines = FRAME_END_SCANLINE + 1, clock_lines = VISIBLE_SCANLINE + 1;
+    int current = pp -> pipeline_state == PRE_RENDER ? 0 : pp -> scanline + 1;
+
+    // Clocks and lines are numbered from the start of this frame, the clocks go on in the next ones
+    int first  = current < clock_lines && pp -> cycle <= 260 ? current : current + 1 < clock_lines ? current + 1 : clock_lines;
+    int clock  = first + clocks - 1;
+    int target = clock / clock_lines * frame_lines + clock % clock_lines;
+    if(target == current) return 260 - pp -> cycle + 1;
+
+    int end  = pp -> pipeline_state == PRE_RENDER && !pp -> even_frame ? line - 1 : line;
+    int dots = end - pp -> cycle + 1 + (target - current - 1) * line + 260;
+
+    // Pre-render lines crossed on the way, every other one is an odd frame's
+    int pre_renders = (target - 1) / frame_lines;
+    return dots - (pp -> even_frame ? (pre_renders + 1) / 2 : pre_renders / 2);
 }
 
 void reset(ppu pp){
@@ -319,27 +591,35 @@ void reset(ppu pp){
     // m_baseNameTable = 0x2000;
     pp -> data_address_increment = 1;
     pp -> pipeline_state = PRE_RENDER;
-
-    bv_reserve(pp -> scanline_sprites, 8);
-    bv_resize(pp -> scanline_sprites, 0);
+    pp -> line_clocks = 0;
+    pp -> emphasis = 0;
+    resolve_palettes(pp);
+    pp -> line_sprite_zero = false;
+    memset(pp -> sprite_line, 0, sizeof(pp -> sprite_line));
+    pp -> secondary_count = 0;
 }
 
 void setInterruptCallback(ppu pp, void(*cb)(cpu)){
     pp -> vblank_callback = cb;
 }
 
+void set_rendering_callback(ppu pp, void (*callback)(void* owner), void* owner){
+    pp -> rendering_callback = callback;
+    pp -> rendering_owner = owner;
+}
+
 uint8_t readOAM(ppu pp, uint16_t addr){
-    return pp -> sprite_memory -> data[addr];
+    return pp -> sprite_memory[addr];
 }
 
 void writeOAM(ppu pp, uint16_t addr, uint8_t v){
-    pp -> sprite_memory -> data[addr] = v;
+    pp -> sprite_memory[addr] = v;
 }
 
 void doDMA(ppu pp, uint8_t* page_ptr){
-    memcpy(pp -> sprite_memory -> data + pp -> sprite_data_address, page_ptr, 256 - pp -> sprite_data_address);
+    memcpy(pp -> sprite_memory + pp -> sprite_data_address, page_ptr, 256 - pp -> sprite_data_address);
     if (pp -> sprite_data_address)
-        memcpy(pp -> sprite_memory -> data, page_ptr + (256 - pp -> sprite_data_address), pp -> sprite_data_address);
+        memcpy(pp -> sprite_memory, page_ptr + (256 - pp -> sprite_data_address), pp -> sprite_data_address);
 }
 
 void control(ppu pp, uint8_t ctrl){
@@ -356,11 +636,17 @@ void control(ppu pp, uint8_t ctrl){
 }
 
 void setMask(ppu pp, uint8_t mask){
+    bool grayscale = pp -> grayscale_mode;
     pp -> grayscale_mode       = mask & 0x1;
+    pp -> emphasis             = mask >> 5;
+    if(grayscale != pp -> grayscale_mode) resolve_palettes(pp);
     pp -> hide_edge_backgound  = !(mask & 0x2);
     pp -> hide_edge_sprites    = !(mask & 0x4);
+    bool rendering = pp -> show_background && pp -> show_sprites;
     pp -> show_background      = mask & 0x8;
     pp -> show_sprites         = mask & 0x10;
+    if(pp -> rendering_callback && rendering != (pp -> show_background && pp -> show_sprites))
+        pp -> rendering_callback(pp -> rendering_owner);
 }
 
 void setOAMAddress(ppu pp, uint8_t addr){
@@ -423,4 +709,31 @@ uint8_t getOAMData(ppu pp){
 
 void setOAMData(ppu pp, uint8_t value){
     writeOAM(pp, pp -> sprite_data_address++, value);
-}
\ No newline at end of file
+}
+
+// CPU bus register handlers
+static uint8_t read_ppu_status(void* owner, uint16_t addr) { (void)addr; return getStatus((ppu)owner); }
+static uint8_t read_ppu_data(void* owner, uint16_t addr) { (void)addr; return getData((ppu)owner); }
+static uint8_t read_oam_data(void* owner, uint16_t addr) { (void)addr; return getOAMData((ppu)owner); }
+
+static void write_ppu_ctrl(void* owner, uint16_t addr, uint8_t v) { (void)addr; control((ppu)owner, v); }
+static void write_ppu_mask(void* owner, uint16_t addr, uint8_t v) { (void)addr; setMask((ppu)owner, v); }
+static void write_oam_addr(void* owner, uint16_t addr, uint8_t v) { (void)addr; setOAMAddress((ppu)owner, v); }
+static void write_oam_data(void* owner, uint16_t addr, uint8_t v) { (void)addr; setOAMData((ppu)owner, v); }
+static void write_ppu_scroll(void* owner, uint16_t addr, uint8_t v) { (void)addr; setScroll((ppu)owner, v); }
+static void write_ppu_addr(void* owner, uint16_t addr, uint8_t v) { (void)addr; setDataAddress((ppu)owner, v); }
+static void write_ppu_data(void* owner, uint16_t addr, uint8_t v) { (void)addr; setData((ppu)owner, v); }
+
+void ppu_map_registers(ppu pp, struct CPUBus* b){
+    set_register_reader(b, PPU_STATUS, read_ppu_status, pp);
+    set_register_reader(b, OAM_DATA,   read_oam_data,   pp);
+    set_register_reader(b, PPU_DATA,   read_ppu_data,   pp);
+
+    set_register_writer(b, PPU_CTRL,   write_ppu_ctrl,   pp);
+    set_register_writer(b, PPU_MASK,   write_ppu_mask,   pp);
+    set_register_writer(b, OAM_ADDR,   write_oam_addr,   pp);
+    set_register_writer(b, OAM_DATA,   write_oam_data,   pp);
+    set_register_writer(b, PPU_SCROL,  write_ppu_scroll, pp);
+    set_register_writer(b, PPU_ADDR,   write_ppu_addr,   pp);
+    set_register_writer(b, PPU_DATA,   write_ppu_data,   pp);
+}